@@ -0,0 +1,110 @@
+"use strict";
+var Module = require('module');
+var path = require('path');
+
+// `node bench --binary <path>` points every load of fibers.node at another build, so builds made
+// with different `coro_backend` settings can be compared against the same JavaScript.
+if (process.env.FIBERS_BINARY) {
+	var binary = path.resolve(process.env.FIBERS_BINARY);
+	var loadNative = Module._extensions['.node'];
+	Module._extensions['.node'] = function(module, filename) {
+		return loadNative(module, path.basename(filename) === 'fibers.node' ? binary : filename);
+	};
+}
+
+var Fiber = exports.Fiber = require('../fibers');
+var Future = exports.Future = require('../future');
+
+var warmupTime = Number(process.env.BENCH_WARMUP || 200);
+var sampleTime = Number(process.env.BENCH_TIME || 1000);
+
+function now() {
+	var time = process.hrtime();
+	return time[0] * 1e9 + time[1];
+}
+
+function percentile(sorted, pct) {
+	return sorted[Math.min(sorted.length - 1, Math.ceil(pct / 100 * sorted.length) - 1)];
+}
+
+/**
+ * Times `op` in batches of `batch` calls and returns ops/sec along with per-op latency
+ * percentiles, in nanoseconds. Each sample is the mean of one batch, which keeps the timer's own
+ * cost out of operations that only take a few hundred nanoseconds. `afterBatch` is timed along with
+ * the batch, `beforeBatch` isn't.
+ */
+function measure(spec) {
+	var batch = spec.batch || 1;
+	var op = spec.op;
+	var samples = [];
+	var stats = Fiber.stats(), before;
+	var elapsed = 0, ops = 0;
+	for (var phase = 0; phase < 2; ++phase) {
+		var until = now() + (phase ? sampleTime : warmupTime) * 1e6;
+		do {
+			if (spec.beforeBatch) {
+				spec.beforeBatch();
+			}
+			var start = now();
+			for (var ii = 0; ii < batch; ++ii) {
+				op();
+			}
+			if (spec.afterBatch) {
+				spec.afterBatch();
+			}
+			var end = now();
+			if (phase) {
+				samples.push((end - start) / batch);
+				elapsed += end - start;
+				ops += batch;
+			}
+		} while (end < until);
+		if (!phase) {
+			before = Array.prototype.slice.call(Fiber.stats());
+		}
+	}
+	samples.sort(function(a, b) { return a - b; });
+
+	// Include how the pool behaved, since that explains most differences between runs. `stats` is
+	// refreshed in place.
+	Fiber.stats();
+	var counters = {};
+	Fiber.statsFields.forEach(function(name, ii) {
+		if (/^(pool(Hits|Misses)|coroutinesCreated|switches|orphansUnwound)$/.test(name)) {
+			counters[name] = stats[ii] - before[ii];
+		}
+	});
+	return {
+		name: spec.name,
+		ops: ops,
+		opsPerSec: ops / elapsed * 1e9,
+		latency: {
+			mean: elapsed / ops,
+			p50: percentile(samples, 50),
+			p90: percentile(samples, 90),
+			p99: percentile(samples, 99),
+			p999: percentile(samples, 99.9),
+			max: samples[samples.length - 1],
+		},
+		counters: counters,
+	};
+}
+
+/**
+ * Runs each benchmark inside a fiber, so that ops may wait on futures, and writes one JSON
+ * result per line for `bench/index.js` to collect.
+ */
+exports.run = function(specs) {
+	Fiber(function() {
+		specs.forEach(function(spec) {
+			if (spec.setup) {
+				spec.setup();
+			}
+			var result = measure(spec);
+			if (spec.teardown) {
+				spec.teardown();
+			}
+			process.stdout.write(JSON.stringify(result)+ '\n');
+		});
+	}).run();
+};
@@ -0,0 +1,49 @@
+#!/usr/bin/env node
+"use strict";
+/**
+ * Compares two reports written by `node bench`, printing the throughput and p99 of the second
+ * relative to the first.
+ *
+ *   node bench/compare.js base.json new.json
+ */
+var fs = require('fs');
+
+if (process.argv.length !== 4) {
+	console.error('Usage: node bench/compare.js base.json new.json');
+	process.exit(1);
+}
+var base = JSON.parse(fs.readFileSync(process.argv[2], 'utf8'));
+var next = JSON.parse(fs.readFileSync(process.argv[3], 'utf8'));
+
+function key(result) {
+	return result.suite+ '/'+ result.name;
+}
+
+function pad(value, width) {
+	value = String(value);
+	return value.length < width ? value + Array(width - value.length + 1).join(' ') : value;
+}
+
+function change(from, to) {
+	var pct = (to / from - 1) * 100;
+	return (pct >= 0 ? '+' : '')+ pct.toFixed(1)+ '%';
+}
+
+var baseline = {};
+base.results.forEach(function(result) {
+	baseline[key(result)] = result;
+});
+console.log(pad('benchmark', 36)+ pad(base.label, 14)+ pad(next.label, 14)+ pad('ops/sec', 10)+ 'p99');
+next.results.forEach(function(result) {
+	var prev = baseline[key(result)];
+	if (!prev) {
+		return;
+	}
+	console.log(
+		pad(key(result), 36)+
+		pad(Math.round(prev.opsPerSec), 14)+
+		pad(Math.round(result.opsPerSec), 14)+
+		pad(change(prev.opsPerSec, result.opsPerSec), 10)+
+		change(prev.latency.p99, result.latency.p99)
+	);
+});
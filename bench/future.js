@@ -0,0 +1,44 @@
+"use strict";
+var common = require('./common');
+var Future = common.Future;
+
+var fanout = 16;
+
+function later() {
+	var future = new Future;
+	setImmediate(function() {
+		future.return(1);
+	});
+	return future;
+}
+
+var work = function(value) {
+	return value + 1;
+}.future();
+
+common.run([
+	{
+		// Wait on a batch of futures which resolve on the next turn of the event loop
+		name: 'future-wait-fanout',
+		batch: 10,
+		op: function() {
+			var futures = [];
+			for (var ii = 0; ii < fanout; ++ii) {
+				futures.push(later());
+			}
+			Future.wait(futures);
+		},
+	},
+	{
+		// Start a batch of FiberFutures, each in its own fiber, and wait for all of them
+		name: 'fiber-future',
+		batch: 10,
+		op: function() {
+			var futures = [];
+			for (var ii = 0; ii < fanout; ++ii) {
+				futures.push(work(ii));
+			}
+			Future.wait(futures);
+		},
+	},
+]);
@@ -0,0 +1,190 @@
+#!/usr/bin/env node
+"use strict";
+/**
+ * End to end benchmark of a request path built on fibers and futures. A loopback HTTP server runs
+ * every request in its own fiber, which reads two files through `Future.wrap`, waits on two timers
+ * and responds. A load generator in a child process keeps `--connections` requests in flight for
+ * `--duration` and the result is printed as JSON.
+ *
+ *   node bench/http.js [--duration 10s] [--connections 64] [--wait 1] [--binary fibers.node]
+ */
+var childProcess = require('child_process');
+var fs = require('fs');
+var http = require('http');
+var path = require('path');
+
+var options = { duration: '10s', connections: '64', wait: '1', binary: undefined, label: undefined, port: undefined };
+var argv = process.argv.slice(2);
+for (var ii = 0; ii < argv.length; ii += 2) {
+	var match = /^--(\w+)$/.exec(argv[ii]);
+	if (!match || !(match[1] in options) || ii + 1 === argv.length) {
+		console.error('Usage: node bench/http.js [--duration 10s] [--connections 64] [--wait ms] [--binary fibers.node]');
+		process.exit(1);
+	}
+	options[match[1]] = argv[ii + 1];
+}
+
+function parseTime(value) {
+	var match = /^(\d+(?:\.\d+)?)(ms|s|m)?$/.exec(value);
+	if (!match) {
+		throw new Error('Bad time: '+ value);
+	}
+	return match[1] * { ms: 1, s: 1e3, m: 60e3 }[match[2] || 'ms'];
+}
+
+function now() {
+	var time = process.hrtime();
+	return time[0] * 1e9 + time[1];
+}
+
+var duration = parseTime(options.duration);
+var warmup = Math.min(2000, duration / 5);
+
+/**
+ * Load generator: keeps `connections` requests going until time is up, recording each latency once
+ * warmup is over, and sends the summary to the parent process.
+ */
+function generateLoad() {
+	var agent = new http.Agent({ keepAlive: true, maxSockets: Number(options.connections) });
+	var latencies = [], errors = 0;
+	var measureFrom = now(), measureTo;
+	var done = false;
+	setTimeout(function() {
+		measureFrom = now();
+		latencies = [];
+		errors = 0;
+	}, warmup);
+	setTimeout(function() {
+		done = true;
+		measureTo = now();
+	}, warmup + duration);
+
+	var request = function() {
+		if (done) {
+			if (--active === 0) {
+				finish();
+			}
+			return;
+		}
+		var begin = now();
+		http.get({ host: '127.0.0.1', port: options.port, path: '/', agent: agent }, function(res) {
+			res.resume();
+			res.on('end', function() {
+				if (res.statusCode === 200) {
+					latencies.push(now() - begin);
+				} else {
+					++errors;
+				}
+				request();
+			});
+		}).on('error', function() {
+			++errors;
+			request();
+		});
+	};
+	var finish = function() {
+		latencies.sort(function(a, b) { return a - b; });
+		var pick = function(pct) {
+			return latencies[Math.min(latencies.length - 1, Math.ceil(pct / 100 * latencies.length) - 1)] / 1e6;
+		};
+		var elapsed = (measureTo - measureFrom) / 1e9;
+		process.send({
+			requests: latencies.length,
+			errors: errors,
+			reqPerSec: latencies.length / elapsed,
+			latencyMs: {
+				mean: latencies.reduce(function(sum, value) { return sum + value; }, 0) / latencies.length / 1e6,
+				p50: pick(50),
+				p99: pick(99),
+				p999: pick(99.9),
+				max: latencies[latencies.length - 1] / 1e6,
+			},
+		});
+		agent.destroy();
+	};
+	var active = Number(options.connections);
+	for (var ii = 0; ii < active; ++ii) {
+		request();
+	}
+}
+
+/**
+ * Server: runs each request in a fiber, starts the load generator and reports once it's done
+ */
+function serve() {
+	if (options.binary) {
+		process.env.FIBERS_BINARY = path.resolve(options.binary);
+	}
+	var common = require('./common');
+	var Fiber = common.Fiber;
+	var Future = common.Future;
+
+	var readFile = Future.wrap(fs.readFile);
+	var files = [ path.join(__dirname, '..', 'package.json'), path.join(__dirname, '..', 'fibers.js') ];
+	var wait = Number(options.wait);
+
+	var sleep = function(ms) {
+		var future = new Future;
+		setTimeout(function() {
+			future.return();
+		}, ms);
+		return future;
+	};
+
+	var handle = function(req, res) {
+		var config = JSON.parse(readFile(files[0], 'utf8').wait());
+		sleep(wait).wait();
+		var source = readFile(files[1]).wait();
+		sleep(wait).wait();
+		res.setHeader('Content-Type', 'text/plain');
+		res.end(config.name+ ' '+ source.length+ '\n');
+	};
+
+	var server = http.createServer(function(req, res) {
+		Fiber(function() {
+			try {
+				handle(req, res);
+			} catch (err) {
+				res.statusCode = 500;
+				res.end(String(err));
+			}
+		}).run();
+	});
+
+	server.listen(0, '127.0.0.1', function() {
+		var before = Array.prototype.slice.call(Fiber.stats());
+		var client = childProcess.fork(__filename, [
+			'--port', String(server.address().port),
+			'--duration', String(duration),
+			'--connections', options.connections,
+		]);
+		client.on('message', function(result) {
+			var stats = Fiber.stats(), counters = {};
+			Fiber.statsFields.forEach(function(name, ii) {
+				if (/^(pool(Hits|Misses)|coroutinesCreated|switches)$/.test(name)) {
+					counters[name] = stats[ii] - before[ii];
+				}
+			});
+			var report = {
+				label: options.label || (options.binary ? path.basename(path.dirname(path.resolve(options.binary))) : 'default'),
+				node: process.version,
+				connections: Number(options.connections),
+				wait: wait,
+				requests: result.requests,
+				errors: result.errors,
+				reqPerSec: result.reqPerSec,
+				latencyMs: result.latencyMs,
+				counters: counters,
+			};
+			process.stdout.write(JSON.stringify(report, null, '\t')+ '\n');
+			server.close();
+			process.exit(result.errors ? 1 : 0);
+		});
+	});
+}
+
+if (options.port) {
+	generateLoad();
+} else {
+	serve();
+}
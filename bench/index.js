@@ -0,0 +1,82 @@
+#!/usr/bin/env node
+"use strict";
+/**
+ * Runs the benchmarks in this directory, each in its own process, and prints the results as JSON.
+ *
+ *   node bench [--binary path/to/fibers.node] [--label name] [--time ms] [benchmark ...]
+ *
+ * `--binary` runs against another build, for example one made with
+ * `node-gyp rebuild -- -Dcoro_backend=ucontext`. Save the output of two runs and compare them with
+ * `node bench/compare.js base.json new.json`.
+ */
+var fs = require('fs');
+var os = require('os');
+var path = require('path');
+var spawnSync = require('child_process').spawnSync;
+
+var skip = [ 'common.js', 'compare.js', 'http.js', 'index.js', 'soak.js' ];
+var options = { label: undefined, binary: undefined, time: undefined };
+var only = [];
+var argv = process.argv.slice(2);
+for (var ii = 0; ii < argv.length; ++ii) {
+	var match = /^--(\w+)$/.exec(argv[ii]);
+	if (match) {
+		if (!(match[1] in options) || ii + 1 === argv.length) {
+			console.error('Unknown or incomplete option: '+ argv[ii]);
+			process.exit(1);
+		}
+		options[match[1]] = argv[++ii];
+	} else {
+		only.push(argv[ii].replace(/\.js$/, ''));
+	}
+}
+
+var env = {};
+for (var key in process.env) {
+	env[key] = process.env[key];
+}
+if (options.binary) {
+	env.FIBERS_BINARY = path.resolve(options.binary);
+}
+if (options.time) {
+	env.BENCH_TIME = options.time;
+}
+
+var report = {
+	label: options.label || (options.binary ? path.basename(path.dirname(path.resolve(options.binary))) : 'default'),
+	binary: env.FIBERS_BINARY || null,
+	node: process.version,
+	platform: process.platform+ '-'+ process.arch,
+	cpu: os.cpus()[0].model,
+	date: new Date().toISOString(),
+	results: [],
+};
+var failed = false;
+fs.readdirSync(__dirname).sort().forEach(function(file) {
+	if (!/\.js$/.test(file) || skip.indexOf(file) !== -1) {
+		return;
+	}
+	var suite = file.replace(/\.js$/, '');
+	if (only.length && only.indexOf(suite) === -1) {
+		return;
+	}
+	var proc = spawnSync(process.execPath, [ '--expose-gc', path.join(__dirname, file) ], {
+		env: env,
+		encoding: 'utf8',
+		stdio: [ 'ignore', 'pipe', 'inherit' ],
+	});
+	if (proc.status !== 0) {
+		console.error(suite+ ': failed ('+ (proc.signal || proc.status)+ ')');
+		failed = true;
+	}
+	proc.stdout.split('\n').forEach(function(line) {
+		if (line) {
+			var result = JSON.parse(line);
+			result.suite = suite;
+			report.results.push(result);
+			console.error(suite+ '/'+ result.name+ ': '+ Math.round(result.opsPerSec)+ ' ops/sec');
+		}
+	});
+});
+process.stdout.write(JSON.stringify(report, null, '\t')+ '\n');
+process.exit(failed ? 1 : 0);
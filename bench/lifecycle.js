@@ -0,0 +1,72 @@
+"use strict";
+var common = require('./common');
+var Fiber = common.Fiber;
+
+function noop() {}
+
+function recurse(depth) {
+	var frame = [ depth, depth, depth, depth ];
+	return depth ? recurse(depth - 1) + frame.length : 0;
+}
+
+var poolSize, poolMaxSize;
+function savePool() {
+	poolSize = Fiber.poolSize;
+	poolMaxSize = Fiber.poolMaxSize;
+}
+function restorePool() {
+	Fiber.poolSize = poolSize;
+	Fiber.poolMaxSize = poolMaxSize;
+}
+
+common.run([
+	{
+		// Create, run to completion and finish; every coroutine comes from the pool
+		name: 'churn-pooled',
+		batch: 200,
+		op: function() {
+			Fiber(noop).run();
+		},
+	},
+	{
+		// The same with the pool disabled, so every fiber allocates and frees its coroutine
+		name: 'churn-unpooled',
+		batch: 200,
+		setup: function() {
+			savePool();
+			Fiber.poolSize = 0;
+			Fiber.poolMaxSize = 0;
+			Fiber.trim();
+		},
+		op: function() {
+			Fiber(noop).run();
+		},
+		teardown: restorePool,
+	},
+	{
+		// Many fibers alive at once, more than the pool holds
+		name: 'churn-burst',
+		batch: 1,
+		op: function() {
+			var fibers = [];
+			for (var ii = 0; ii < 500; ++ii) {
+				var fiber = Fiber(Fiber.yield);
+				fiber.run();
+				fibers.push(fiber);
+			}
+			for (var ii = 0; ii < fibers.length; ++ii) {
+				fibers[ii].run();
+			}
+		},
+	},
+	{
+		// A fiber which touches most of a 1mb stack before finishing
+		name: 'deep-stack',
+		batch: 20,
+		op: function() {
+			Fiber(function() {
+				recurse(4000);
+			}, { stackSize: 1024 * 1024 }).run();
+		},
+	},
+]);
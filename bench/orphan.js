@@ -0,0 +1,72 @@
+"use strict";
+var common = require('./common');
+var Fiber = common.Fiber;
+var Future = common.Future;
+
+if (typeof gc !== 'function') {
+	throw new Error('Run with --expose-gc');
+}
+
+function abandoned() {
+	try {
+		Fiber.yield();
+	} finally {
+		// Unwinding runs this when the fiber is collected
+	}
+}
+
+function finished() {}
+
+var suspended = [];
+
+// Collects, then lets the event loop turn until the orphans it found have been unwound
+var pending = Fiber.statsFields.indexOf('orphansPending');
+function collect() {
+	gc();
+	do {
+		var future = new Future;
+		setImmediate(function() {
+			future.return();
+		});
+		future.wait();
+	} while (pending !== -1 && Fiber.stats()[pending] > 0);
+}
+
+common.run([
+	{
+		// Start fibers and drop them while they're yielding. Each batch ends with a full collection,
+		// which finds the orphans so they're unwound from the event loop. The cost per op includes a
+		// share of both.
+		name: 'orphan-gc',
+		batch: 500,
+		op: function() {
+			Fiber(abandoned).run();
+		},
+		afterBatch: collect,
+	},
+	{
+		// Baseline for the above: fibers which finish, and the same collections
+		name: 'orphan-gc-baseline',
+		batch: 500,
+		op: function() {
+			Fiber(finished).run();
+		},
+		afterBatch: collect,
+	},
+	{
+		// Unwinding alone: each op resets one suspended fiber, which takes the same path as an orphan
+		// found by the collector. Starting them happens outside the timed part.
+		name: 'orphan-unwind',
+		batch: 500,
+		beforeBatch: function() {
+			for (var ii = 0; ii < 500; ++ii) {
+				var fiber = Fiber(abandoned);
+				fiber.run();
+				suspended.push(fiber);
+			}
+		},
+		op: function() {
+			suspended.pop().reset();
+		},
+	},
+]);
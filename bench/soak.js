@@ -0,0 +1,195 @@
+#!/usr/bin/env node
+"use strict";
+/**
+ * Long running soak test. Drives a changing mix of fibers which finish, yield and get resumed,
+ * wait on futures, recurse deeply, or get abandoned for the garbage collector to unwind. Memory,
+ * mappings and pool state are sampled as it runs and written to stdout as one JSON object per line.
+ *
+ *   node bench/soak.js [--duration 2h] [--interval 10s] [--binary path/to/fibers.node]
+ *
+ * At the end RSS, the number of mappings and the orphan backlog must have leveled off: the peak of
+ * the last quarter of the run is compared to the peak of the quarter before it, after skipping the
+ * first half as warmup. Exits with 1 if any of them kept growing.
+ */
+var fs = require('fs');
+var path = require('path');
+
+var options = { duration: '2h', interval: '10s', binary: undefined };
+var argv = process.argv.slice(2);
+for (var ii = 0; ii < argv.length; ii += 2) {
+	var match = /^--(\w+)$/.exec(argv[ii]);
+	if (!match || !(match[1] in options) || ii + 1 === argv.length) {
+		console.error('Usage: node bench/soak.js [--duration 2h] [--interval 10s] [--binary fibers.node]');
+		process.exit(1);
+	}
+	options[match[1]] = argv[ii + 1];
+}
+if (options.binary) {
+	process.env.FIBERS_BINARY = path.resolve(options.binary);
+}
+
+function parseTime(value) {
+	var match = /^(\d+(?:\.\d+)?)(ms|s|m|h)?$/.exec(value);
+	if (!match) {
+		throw new Error('Bad time: '+ value);
+	}
+	return match[1] * { ms: 1, s: 1e3, m: 60e3, h: 3600e3 }[match[2] || 'ms'];
+}
+
+var common = require('./common');
+var Fiber = common.Fiber;
+var Future = common.Future;
+
+var duration = parseTime(options.duration);
+var interval = parseTime(options.interval);
+
+// Growth allowed between the two compared quarters before a series counts as a leak
+var tolerance = {
+	rss: { ratio: 0.05, slack: 8 * 1024 * 1024 },
+	vmas: { ratio: 0.05, slack: 16 },
+	orphanBacklog: { ratio: 0.5, slack: 1000 },
+};
+
+//
+// Workload
+//
+var suspended = [];
+
+function sleep(ms) {
+	var future = new Future;
+	setTimeout(function() {
+		future.return();
+	}, ms);
+	return future;
+}
+
+function recurse(depth) {
+	var frame = [ depth, depth, depth, depth ];
+	return depth ? recurse(depth - 1) + frame.length : 0;
+}
+
+// Each task runs in a fiber with its own stack size, so that several size classes are in use
+var tasks = [
+	// Finishes right away
+	[ 64 * 1024, function() {
+		return 1;
+	} ],
+	// Yields and gets resumed from a later tick, or abandoned if it's still waiting too long
+	[ 64 * 1024, function() {
+		suspended.push(Fiber.current);
+		Fiber.yield();
+	} ],
+	// Abandoned without ever being resumed
+	[ 256 * 1024, function() {
+		Fiber.yield();
+	} ],
+	// Waits on a couple of timers
+	[ 256 * 1024, function() {
+		Future.wait(sleep(Math.random() * 20), sleep(Math.random() * 20));
+	} ],
+	// Uses a lot of its stack
+	[ 1024 * 1024, function() {
+		recurse(500 + Math.floor(Math.random() * 2000));
+		sleep(1).wait();
+	} ],
+];
+
+var started = Date.now();
+function tick() {
+	var elapsed = Date.now() - started;
+	if (elapsed >= duration) {
+		return;
+	}
+	// Load swings between light and heavy every four minutes so the pool grows and decays. Even at
+	// its peak it should leave the process some idle time, otherwise samples are taken late.
+	var load = Math.round(10 + 90 * (1 + Math.sin(elapsed / 120e3 * Math.PI)) / 2);
+	for (var ii = 0; ii < load; ++ii) {
+		var task = tasks[Math.floor(Math.random() * tasks.length)];
+		Fiber(task[1], { stackSize: task[0] }).run();
+	}
+	// Resume some suspended fibers, abandon the oldest ones
+	var resume = suspended.splice(0, Math.floor(suspended.length / 2));
+	for (var ii = 0; ii < resume.length; ++ii) {
+		resume[ii].run();
+	}
+	if (suspended.length > 2000) {
+		suspended.splice(0, suspended.length - 2000);
+	}
+	setTimeout(tick, 10);
+}
+
+//
+// Sampling
+//
+function countMappings() {
+	try {
+		return fs.readFileSync('/proc/self/maps', 'utf8').split('\n').length - 1;
+	} catch (err) {
+		return null;
+	}
+}
+
+var samples = [];
+function sample() {
+	var memory = process.memoryUsage();
+	var stats = Fiber.stats(), counters = {};
+	Fiber.statsFields.forEach(function(name, ii) {
+		counters[name] = stats[ii];
+	});
+	var point = {
+		time: Date.now() - started,
+		rss: memory.rss,
+		heapUsed: memory.heapUsed,
+		vmas: countMappings(),
+		poolSize: counters.poolSize,
+		fibersLive: counters.fibersLive,
+		orphanBacklog: counters.orphansQueued - counters.orphansUnwound,
+		orphansUnwound: counters.orphansUnwound,
+		coroutinesCreated: counters.coroutinesCreated,
+		stackCommitted: counters.stackCommitted,
+		stackResident: Fiber.stackResident,
+	};
+	samples.push(point);
+	process.stdout.write(JSON.stringify(point)+ '\n');
+}
+
+function peak(points, key) {
+	return points.reduce(function(max, point) {
+		return Math.max(max, point[key]);
+	}, -Infinity);
+}
+
+function verdict() {
+	var quarter = Math.floor(samples.length / 4);
+	if (quarter < 2) {
+		console.error('soak: not enough samples to judge, run longer or sample more often');
+		return 1;
+	}
+	var previous = samples.slice(quarter * 2, quarter * 3);
+	var last = samples.slice(quarter * 3);
+	var failed = 0;
+	Object.keys(tolerance).forEach(function(key) {
+		if (samples[0][key] === null) {
+			return;
+		}
+		var before = peak(previous, key), after = peak(last, key);
+		var limit = before * (1 + tolerance[key].ratio) + tolerance[key].slack;
+		var ok = after <= limit;
+		console.error('soak: '+ key+ ' '+ before+ ' -> '+ after+ (ok ? ' ok' : ' still growing'));
+		failed |= !ok;
+	});
+	return failed ? 1 : 0;
+}
+
+sample();
+var sampler = setInterval(sample, interval);
+tick();
+setTimeout(function() {
+	clearInterval(sampler);
+	// Let outstanding timers finish and drop whatever is still suspended
+	suspended = [];
+	setTimeout(function() {
+		sample();
+		process.exit(verdict());
+	}, 200);
+}, duration);
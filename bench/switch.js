@@ -0,0 +1,45 @@
+"use strict";
+var common = require('./common');
+var Fiber = common.Fiber;
+
+var fiber;
+common.run([
+	{
+		// One run() and one yield() back, i.e. two context switches
+		name: 'run-yield',
+		batch: 1000,
+		setup: function() {
+			fiber = Fiber(function() {
+				for (;;) {
+					Fiber.yield();
+				}
+			});
+			fiber.run();
+		},
+		op: function() {
+			fiber.run();
+		},
+		teardown: function() {
+			fiber.reset();
+		},
+	},
+	{
+		// Same thing with a value in each direction
+		name: 'run-yield-value',
+		batch: 1000,
+		setup: function() {
+			fiber = Fiber(function(value) {
+				for (;;) {
+					value = Fiber.yield(value + 1);
+				}
+			});
+			fiber.run(0);
+		},
+		op: function() {
+			fiber.run(1);
+		},
+		teardown: function() {
+			fiber.reset();
+		},
+	},
+]);
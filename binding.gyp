@@ -1,4 +1,11 @@
 {
+	'variables': {
+		# Context switch backend for Linux glibc on x64, arm and arm64. `asm` uses libcoro's hand
+		# written switcher which only saves callee-saved registers. `ucontext` falls back to
+		# swapcontext() (or one pthread per fiber on arm), which is much slower. Override with:
+		# `node-gyp rebuild -- -Dcoro_backend=ucontext`
+		'coro_backend%': 'asm',
+	},
 	'target_defaults': {
 		'default_configuration': 'Release',
 		'configurations': {
@@ -47,7 +54,14 @@
 						'conditions': [
 							['<(USE_MUSL) == 1',
 								{'defines': ['CORO_ASM', '__MUSL__']},
-								{'defines': ['CORO_UCONTEXT']}
+								{
+									'conditions': [
+										['target_arch == "x64" and coro_backend == "asm"',
+											{'defines': ['CORO_ASM']},
+											{'defines': ['CORO_UCONTEXT']}
+										],
+									],
+								},
 							],
 						],
 					},
@@ -55,16 +69,20 @@
 				['OS == "solaris" or OS == "sunos" or OS == "freebsd" or OS == "aix"', {'defines': ['CORO_UCONTEXT']}],
 				['OS == "mac"', {'defines': ['CORO_ASM']}],
 				['OS == "openbsd"', {'defines': ['CORO_ASM']}],
-				['target_arch == "arm"',
+				['OS != "win" and (target_arch == "arm" or target_arch == "arm64") and coro_backend == "asm"',
+					{
+						'defines': ['CORO_ASM'],
+						'defines!': ['CORO_UCONTEXT', 'CORO_SJLJ', 'CORO_PTHREAD'],
+					},
+				],
+				['target_arch == "arm" and coro_backend != "asm"',
 					{
-						# There's been problems getting real fibers working on arm
 						'defines': ['CORO_PTHREAD'],
 						'defines!': ['CORO_UCONTEXT', 'CORO_SJLJ', 'CORO_ASM'],
 					},
 				],
-				['target_arch == "arm64"',
+				['target_arch == "arm64" and coro_backend != "asm"',
 					{
-						# There's been problems getting real fibers working on arm
 						'defines': ['CORO_UCONTEXT', '_XOPEN_SOURCE'],
 						'defines!': ['CORO_PTHREAD', 'CORO_SJLJ', 'CORO_ASM'],
 					},
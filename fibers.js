@@ -13,6 +13,9 @@ if (process.fiberLib) {
 		// Pull in fibers implementation
 		process.fiberLib = module.exports = require(modPath).Fiber;
 	} catch (ex) {
+		if (ex.code === 'ERR_FIBER_WORKER') {
+			throw ex;
+		}
 		// No binary!
 		console.error(
 			'## There is an issue with `node-fibers` ##\n'+
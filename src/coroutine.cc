@@ -1,8 +1,11 @@
 #include "coroutine.h"
 #include "v8-version.h"
 #include <assert.h>
+#include <string.h>
 #ifndef WINDOWS
 #include <pthread.h>
+#include <sys/mman.h>
+#include <unistd.h>
 #else
 #include <windows.h>
 #include <intrin.h>
@@ -14,25 +17,416 @@
 #define pthread_key_create(key, dtor) (*key)=TlsAlloc()
 #define pthread_setspecific(key, val) TlsSetValue((key), (val))
 #define pthread_getspecific(key) TlsGetValue((key))
+#define pthread_mutex_t SRWLOCK
+#define PTHREAD_MUTEX_INITIALIZER SRWLOCK_INIT
+#define pthread_mutex_lock(mutex) AcquireSRWLockExclusive(mutex)
+#define pthread_mutex_unlock(mutex) ReleaseSRWLockExclusive(mutex)
 #endif
 
+#include <mutex>
 #include <stdexcept>
 #include <stack>
 #include <vector>
 using namespace std;
 
-const size_t v8_tls_keys = 3;
-static std::vector<void*> fls_data_pool;
-static pthread_key_t coro_thread_key = 0;
+// v8's thread local keys are the same on every thread, so they're only looked up once
+static pthread_key_t last_key = 0;
 static pthread_key_t isolate_key = 0x7777;
 static pthread_key_t thread_id_key = 0x7777;
 static pthread_key_t thread_data_key = 0x7777;
+static bool found_keys = false;
+static std::mutex found_keys_mutex;
 
-static size_t stack_size = 0;
-static size_t coroutines_created_ = 0;
-static vector<Coroutine*> fiber_pool;
-static Coroutine* delete_me = NULL;
-size_t Coroutine::pool_size = 120;
+// libcoro passes the entry point to a new context through globals, so only one thread at a time
+// may create one
+static std::mutex coro_create_mutex;
+
+// Everything about running and pooling coroutines belongs to one isolate; see ISOLATE_LOCAL. Stack
+// memory below is shared by the whole process. The current coroutine is always per thread, since
+// with CORO_PTHREAD each coroutine's thread sets it for itself.
+static ISOLATE_LOCAL std::vector<void*> fls_data_pool;
+static thread_local Coroutine* current_coroutine = NULL;
+
+static ISOLATE_LOCAL size_t stack_size = 0;
+static ISOLATE_LOCAL size_t coroutines_created_ = 0;
+static ISOLATE_LOCAL size_t coroutines_destroyed_ = 0;
+static ISOLATE_LOCAL size_t pool_hits_ = 0;
+static ISOLATE_LOCAL size_t pool_misses_ = 0;
+static ISOLATE_LOCAL size_t switches_ = 0;
+static ISOLATE_LOCAL vector<Coroutine*> fiber_pool[Coroutine::max_stack_class + 1];
+static ISOLATE_LOCAL size_t pooled = 0;
+// Pooled coroutines below this index have had their stacks trimmed. The most recently pooled ones
+// are likely to be reused right away so they're left alone.
+static ISOLATE_LOCAL size_t fiber_pool_trimmed[Coroutine::max_stack_class + 1];
+static const size_t fiber_pool_hot = 8;
+// The pool may grow past `pool_size` to the peak number of running coroutines, and shrinks back
+// when that peak isn't reached again.
+static ISOLATE_LOCAL size_t running = 0;
+static ISOLATE_LOCAL size_t running_peak = 0;
+static ISOLATE_LOCAL size_t pool_grown = 0;
+static ISOLATE_LOCAL Coroutine* delete_me = NULL;
+static ISOLATE_LOCAL Coroutine* drain_next = NULL;
+ISOLATE_LOCAL size_t Coroutine::pool_size = 120;
+ISOLATE_LOCAL size_t Coroutine::pool_max_size = 1024;
+ISOLATE_LOCAL size_t Coroutine::stack_watermark = 64 * 1024;
+
+static size_t stack_bytes_reserved = 0;
+static size_t stack_bytes_committed = 0;
+// Bytes of stack held by coroutines or the reserve, as opposed to sitting released on a free list.
+// This is what `stack_budget` limits; 0 means no limit.
+static size_t stack_bytes_in_use = 0;
+static size_t stack_budget = 0;
+
+// Stack usage tracking. Unused stack is always zero since it's either fresh from mmap() or has been
+// given back with madvise(); finish() measures the high-water mark and scrubs what was used.
+static ISOLATE_LOCAL bool stack_tracking = false;
+static ISOLATE_LOCAL size_t stack_usage_finished = 0;
+static ISOLATE_LOCAL size_t stack_usage_counts[Coroutine::stack_usage_buckets];
+
+#ifndef CORO_FIBER
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE 0
+#endif
+#if defined(__OpenBSD__) || defined(__FreeBSD__)
+#define STACK_MAP_FLAGS (MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK)
+#else
+#define STACK_MAP_FLAGS (MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE)
+#endif
+#ifndef CORO_GUARDPAGES
+#define CORO_GUARDPAGES 1
+#endif
+#ifdef __linux__
+typedef unsigned char mincore_vec_t;
+#else
+typedef char mincore_vec_t;
+#endif
+#endif
+
+/**
+ * Fiber stacks are carved out of large regions which are reserved up front instead of each getting
+ * their own mmap() and mprotect(). A slot is a guard page followed by the stack, and only becomes
+ * accessible the first time it's handed out. Released slots give their pages back to the OS but
+ * stay mapped on a free list, so reusing one doesn't make any system calls. Stacks sitting in the
+ * fiber pool can also be trimmed, which gives back everything but the top of the stack.
+ *
+ * Optionally a helper thread keeps a reserve of slots which are ready to go and have their top
+ * pages already faulted in, so a burst of new fibers doesn't pay for mprotect() or page faults.
+ * Everything that helper touches is guarded by `stack_mutex`.
+ *
+ * On Windows CreateFiber() allocates the stack itself so this just keeps count. The counts are
+ * shared by every isolate so they're still guarded by `stack_mutex`.
+ */
+static pthread_mutex_t stack_mutex = PTHREAD_MUTEX_INITIALIZER;
+#ifndef CORO_FIBER
+static pthread_cond_t stack_reserve_cond = PTHREAD_COND_INITIALIZER;
+static bool stack_reserve_thread = false;
+#endif
+static size_t stack_reserve = 0;
+static size_t stack_reserve_class = 0;
+static size_t stack_reserve_prefault = 0;
+
+class StackArena {
+	private:
+		static const size_t region_bytes = 64 * 1024 * 1024;
+		size_t stack_bytes;
+		size_t guard_bytes;
+		size_t slot_bytes;
+		size_t page_bytes;
+		size_t mapping_bytes;
+		char* next_slot;
+		char* region_end;
+		vector<char*> regions;
+		vector<char*> free_slots;
+		vector<char*> ready_slots;
+
+#ifndef CORO_FIBER
+		/**
+		 * Makes a brand new slot accessible. Called with `stack_mutex` held.
+		 */
+		char* carve() {
+			if (next_slot == region_end) {
+				void* region = mmap(NULL, mapping_bytes, PROT_NONE, STACK_MAP_FLAGS, -1, 0);
+				if (region == MAP_FAILED) {
+					return NULL;
+				}
+				next_slot = static_cast<char*>(region);
+				region_end = next_slot + mapping_bytes;
+				regions.push_back(next_slot);
+				stack_bytes_reserved += mapping_bytes;
+			}
+			if (mprotect(next_slot + guard_bytes, stack_bytes, PROT_READ | PROT_WRITE) != 0) {
+				return NULL;
+			}
+			char* slot = next_slot;
+			next_slot += slot_bytes;
+			stack_bytes_committed += stack_bytes;
+			return slot;
+		}
+#endif
+
+	public:
+		explicit StackArena(size_t size) : next_slot(NULL), region_end(NULL) {
+#ifdef CORO_FIBER
+			stack_bytes = size * sizeof(void*);
+			guard_bytes = 0;
+			page_bytes = 0;
+#else
+			page_bytes = sysconf(_SC_PAGESIZE);
+			stack_bytes = (size * sizeof(void*) + page_bytes - 1) / page_bytes * page_bytes;
+			guard_bytes = CORO_GUARDPAGES * page_bytes;
+#endif
+			slot_bytes = stack_bytes + guard_bytes;
+			mapping_bytes = region_bytes < slot_bytes ? slot_bytes : region_bytes / slot_bytes * slot_bytes;
+		}
+
+		/**
+		 * True if alloc() would stay within `stack_budget`. Called with `stack_mutex` held.
+		 */
+		bool within_budget() const {
+			return !ready_slots.empty() || !stack_budget || stack_bytes_in_use + stack_bytes <= stack_budget;
+		}
+
+		/**
+		 * Takes a stack from the arena. If `over_budget` is given it's set when the stack budget is
+		 * what stood in the way, as opposed to the OS running out of memory. The budget check and the
+		 * allocation happen under one lock so threads can't race each other past the budget.
+		 */
+		bool alloc(coro_stack& stack, bool* over_budget = NULL) {
+			stack.sptr = NULL;
+#ifdef CORO_FIBER
+			bool ok = false;
+			pthread_mutex_lock(&stack_mutex);
+			if (!within_budget()) {
+				if (over_budget) {
+					*over_budget = true;
+				}
+			} else if (coro_stack_alloc(&stack, stack_bytes / sizeof(void*))) {
+				stack_bytes_reserved += stack_bytes;
+				stack_bytes_committed += stack_bytes;
+				stack_bytes_in_use += stack_bytes;
+				ok = true;
+			}
+			pthread_mutex_unlock(&stack_mutex);
+			return ok;
+#else
+			char* slot = NULL;
+			pthread_mutex_lock(&stack_mutex);
+			if (!ready_slots.empty()) {
+				slot = ready_slots.back();
+				ready_slots.pop_back();
+				if (ready_slots.size() < stack_reserve / 2) {
+					pthread_cond_signal(&stack_reserve_cond);
+				}
+			} else if (within_budget()) {
+				if (!free_slots.empty()) {
+					slot = free_slots.back();
+					free_slots.pop_back();
+				} else {
+					slot = carve();
+				}
+				if (slot) {
+					stack_bytes_in_use += stack_bytes;
+				}
+			} else if (over_budget) {
+				*over_budget = true;
+			}
+			pthread_mutex_unlock(&stack_mutex);
+			if (!slot) {
+				return false;
+			}
+			stack.sptr = slot + guard_bytes;
+			stack.ssze = stack_bytes;
+			return true;
+#endif
+		}
+
+		void free(coro_stack& stack) {
+#ifdef CORO_FIBER
+			coro_stack_free(&stack);
+			pthread_mutex_lock(&stack_mutex);
+			stack_bytes_reserved -= stack_bytes;
+			stack_bytes_committed -= stack_bytes;
+			stack_bytes_in_use -= stack_bytes;
+			pthread_mutex_unlock(&stack_mutex);
+#else
+			madvise(stack.sptr, stack.ssze, MADV_DONTNEED);
+			pthread_mutex_lock(&stack_mutex);
+			free_slots.push_back(static_cast<char*>(stack.sptr) - guard_bytes);
+			stack_bytes_in_use -= stack_bytes;
+			pthread_mutex_unlock(&stack_mutex);
+#endif
+			stack.sptr = NULL;
+		}
+
+		/**
+		 * Releases the pages of an idle stack except for the top `keep` bytes.
+		 */
+		void trim(coro_stack& stack, size_t keep) {
+#ifndef CORO_FIBER
+			if (keep < stack.ssze) {
+				madvise(stack.sptr, (stack.ssze - keep) / page_bytes * page_bytes, MADV_DONTNEED);
+			}
+#endif
+		}
+
+		/**
+		 * Returns how many bytes at the top of `stack` have been written to, assuming the rest is
+		 * zero. Pages that aren't resident can't have been written so they're skipped without being
+		 * read, and resident pages are compared a page at a time with memcmp().
+		 */
+		size_t used(const coro_stack& stack) const {
+#ifdef CORO_FIBER
+			return 0;
+#else
+			static const char zero_page[64 * 1024] = {};
+			static thread_local vector<mincore_vec_t> vec;
+			char* bottom = static_cast<char*>(stack.sptr);
+			char* top = bottom + stack.ssze;
+			vec.resize(stack.ssze / page_bytes);
+			size_t first = 0;
+			if (mincore(bottom, stack.ssze, &vec[0]) == 0) {
+				while (first < vec.size() && !(vec[first] & 1)) {
+					++first;
+				}
+			}
+			for (char* page = bottom + first * page_bytes; page < top; page += page_bytes) {
+				if (page_bytes <= sizeof(zero_page) && memcmp(page, zero_page, page_bytes) == 0) {
+					continue;
+				}
+				void** word = reinterpret_cast<void**>(page);
+				while (!*word) {
+					++word;
+				}
+				return top - reinterpret_cast<char*>(word);
+			}
+			return 0;
+#endif
+		}
+
+		/**
+		 * Zeroes the top `used` bytes of `stack`, except for the caller's frame, so it can be
+		 * measured again.
+		 */
+		void scrub(coro_stack& stack, size_t used) {
+#ifndef CORO_FIBER
+			char* bottom = static_cast<char*>(stack.sptr);
+			char* start = bottom + (stack.ssze - used) / page_bytes * page_bytes;
+			// Leave a page below this frame for madvise() itself
+			char* end = bottom + (reinterpret_cast<char*>(&bottom) - bottom) / page_bytes * page_bytes - page_bytes;
+			if (start < end) {
+				madvise(start, end - start, MADV_DONTNEED);
+			}
+#endif
+		}
+
+		/**
+		 * Faults in the top `bytes` of a stack so the first run of a fiber doesn't have to.
+		 */
+		void prefault(coro_stack& stack, size_t bytes) {
+#ifndef CORO_FIBER
+			char* top = static_cast<char*>(stack.sptr) + stack.ssze;
+			char* end = bytes < stack.ssze ? top - bytes : static_cast<char*>(stack.sptr);
+			for (char* page = top - page_bytes; page >= end; page -= page_bytes) {
+				*reinterpret_cast<volatile char*>(page) = 0;
+			}
+#endif
+		}
+
+#ifndef CORO_FIBER
+		/**
+		 * Gives the memory of the ready slots back to the OS. They stay mapped, on the free list.
+		 * Called with `stack_mutex` held.
+		 */
+		void release_reserve() {
+			for (size_t ii = 0; ii < ready_slots.size(); ++ii) {
+				madvise(ready_slots[ii] + guard_bytes, stack_bytes, MADV_DONTNEED);
+				free_slots.push_back(ready_slots[ii]);
+				stack_bytes_in_use -= stack_bytes;
+			}
+			ready_slots.clear();
+		}
+
+		/**
+		 * Runs on the helper thread with `stack_mutex` held. Tops up the ready slots to `count`.
+		 */
+		void fill_reserve(size_t count, size_t prefault_bytes) {
+			while (ready_slots.size() < count) {
+				char* slot;
+				if (stack_budget && stack_bytes_in_use + stack_bytes > stack_budget) {
+					return;
+				} else if (!free_slots.empty()) {
+					slot = free_slots.back();
+					free_slots.pop_back();
+				} else if (!(slot = carve())) {
+					return;
+				}
+				stack_bytes_in_use += stack_bytes;
+				pthread_mutex_unlock(&stack_mutex);
+				coro_stack stack;
+				stack.sptr = slot + guard_bytes;
+				stack.ssze = stack_bytes;
+				prefault(stack, prefault_bytes);
+				pthread_mutex_lock(&stack_mutex);
+				ready_slots.push_back(slot);
+			}
+		}
+
+		/**
+		 * Returns how many bytes of this arena's stacks are resident in memory. Called with
+		 * `stack_mutex` held.
+		 */
+		size_t resident() const {
+			size_t pages = 0;
+			for (size_t ii = 0; ii < regions.size(); ++ii) {
+				char* start = regions[ii];
+				char* end = ii == regions.size() - 1 ? next_slot : start + mapping_bytes;
+				vector<mincore_vec_t> vec((end - start) / page_bytes);
+				if (vec.empty() || mincore(start, end - start, &vec[0]) != 0) {
+					continue;
+				}
+				for (size_t jj = 0; jj < vec.size(); ++jj) {
+					pages += vec[jj] & 1;
+				}
+			}
+			return pages * page_bytes;
+		}
+#endif
+};
+static StackArena* stack_arenas[Coroutine::max_stack_class + 1];
+
+/**
+ * Returns the arena for a stack size class, creating it if needed.
+ */
+static StackArena* get_stack_arena(size_t stack_class) {
+	pthread_mutex_lock(&stack_mutex);
+	if (!stack_arenas[stack_class]) {
+		stack_arenas[stack_class] = new StackArena((size_t)1 << stack_class);
+	}
+	StackArena* arena = stack_arenas[stack_class];
+	pthread_mutex_unlock(&stack_mutex);
+	return arena;
+}
+
+#ifndef CORO_FIBER
+/**
+ * Body of the helper thread which keeps `stack_reserve` stacks ready to go. It only wakes up once
+ * the reserve drops below half.
+ */
+static void* stack_reserve_main(void*) {
+	pthread_mutex_lock(&stack_mutex);
+	while (true) {
+		StackArena* arena = stack_arenas[stack_reserve_class];
+		if (arena) {
+			arena->fill_reserve(stack_reserve, stack_reserve_prefault);
+		}
+		pthread_cond_wait(&stack_reserve_cond, &stack_mutex);
+	}
+	return NULL;
+}
+#endif
 
 static bool can_poke(void* addr) {
 #ifdef WINDOWS
@@ -91,7 +485,7 @@ static DWORD __stdcall find_thread_id_key(LPVOID arg)
 	// 128 is default max key in musl
 	for (pthread_key_t ii = 1; ii < 128; ++ii) {
 #else
-	for (pthread_key_t ii = coro_thread_key; ii > 0; --ii) {
+	for (pthread_key_t ii = last_key; ii > 0; --ii) {
 #endif
 		void* tls = pthread_getspecific(ii - 1);
 		if (tls == isolate) {
@@ -106,7 +500,7 @@ static DWORD __stdcall find_thread_id_key(LPVOID arg)
 #ifdef __MUSL__
 	for (pthread_key_t ii = 0; ii < 128; ++ii) {
 #else
-	for (pthread_key_t ii = isolate_key + 1; ii < coro_thread_key; ++ii) {
+	for (pthread_key_t ii = isolate_key + 1; ii < last_key; ++ii) {
 #endif
 		void* tls = pthread_getspecific(ii);
 		if (can_poke(tls) && *(void**)tls == isolate) {
@@ -123,7 +517,7 @@ static DWORD __stdcall find_thread_id_key(LPVOID arg)
 #ifdef __MUSL__
 	for (pthread_key_t ii = 0; ii < 128; ++ii) {
 #else
-	for (pthread_key_t ii = isolate_key + 1; ii < coro_thread_key; ++ii) {
+	for (pthread_key_t ii = isolate_key + 1; ii < last_key; ++ii) {
 #endif
 		int tls = static_cast<int>(reinterpret_cast<intptr_t>(pthread_getspecific(ii)));
 		if (tls == thread_id) {
@@ -141,9 +535,15 @@ static DWORD __stdcall find_thread_id_key(LPVOID arg)
  * Coroutine class definition
  */
 void Coroutine::init(v8::Isolate* isolate) {
+	current();
+	std::lock_guard<std::mutex> lock(found_keys_mutex);
+	if (found_keys) {
+		return;
+	}
+	found_keys = true;
 	v8::Unlocker unlocker(isolate);
-	pthread_key_create(&coro_thread_key, NULL);
-	pthread_setspecific(coro_thread_key, &current());
+	// Keys are handed out in increasing order so this bounds the search for v8's keys
+	pthread_key_create(&last_key, NULL);
 #ifdef USE_V8_SYMBOLS
 	isolate_key = v8::internal::Isolate::isolate_key_;
 	thread_data_key = v8::internal::Isolate::per_isolate_thread_data_key_;
@@ -156,33 +556,160 @@ void Coroutine::init(v8::Isolate* isolate) {
 }
 
 Coroutine& Coroutine::current() {
-	Coroutine* current = static_cast<Coroutine*>(pthread_getspecific(coro_thread_key));
-	if (!current) {
-		current = new Coroutine;
-		pthread_setspecific(coro_thread_key, current);
+	if (!current_coroutine) {
+		current_coroutine = new Coroutine;
 	}
-	return *current;
+	return *current_coroutine;
 }
 
-void Coroutine::set_stack_size(unsigned int size) {
-	assert(!stack_size);
+bool Coroutine::set_stack_size(size_t size) {
+	assert(size && size <= max_stack_size());
+	if (coroutines_created_) {
+		return false;
+	}
+	// The reserve is shared by every thread and holds stacks of one size class. A thread which set
+	// it up, or otherwise uses that class, can't move away from it. A new thread picks whatever it
+	// likes, its fibers just won't be served from the reserve.
+#ifndef CORO_FIBER
+	pthread_mutex_lock(&stack_mutex);
+	bool leaves_reserve = stack_reserve && stack_size &&
+		size_class(stack_size) == stack_reserve_class && size_class(size) != stack_reserve_class;
+	pthread_mutex_unlock(&stack_mutex);
+	if (leaves_reserve) {
+		return false;
+	}
+#endif
 	stack_size = size;
+	return true;
+}
+
+size_t Coroutine::get_stack_size() {
+	return stack_size;
+}
+
+size_t Coroutine::max_stack_size() {
+	return (size_t)1 << max_stack_class;
+}
+
+size_t Coroutine::size_class(size_t size) {
+	size_t ii = min_stack_class;
+	while (((size_t)1 << ii) < size) {
+		++ii;
+	}
+	assert(ii <= max_stack_class);
+	return ii;
 }
 
 size_t Coroutine::coroutines_created() {
 	return coroutines_created_;
 }
 
+size_t Coroutine::coroutines_destroyed() {
+	return coroutines_destroyed_;
+}
+
+size_t Coroutine::pool_hits() {
+	return pool_hits_;
+}
+
+size_t Coroutine::pool_misses() {
+	return pool_misses_;
+}
+
+size_t Coroutine::pool_count() {
+	return pooled;
+}
+
+size_t Coroutine::switches() {
+	return switches_;
+}
+
+size_t Coroutine::stack_reserved() {
+	pthread_mutex_lock(&stack_mutex);
+	size_t bytes = stack_bytes_reserved;
+	pthread_mutex_unlock(&stack_mutex);
+	return bytes;
+}
+
+size_t Coroutine::stack_committed() {
+	pthread_mutex_lock(&stack_mutex);
+	size_t bytes = stack_bytes_committed;
+	pthread_mutex_unlock(&stack_mutex);
+	return bytes;
+}
+
+size_t Coroutine::stack_resident() {
+#ifdef CORO_FIBER
+	return stack_committed();
+#else
+	size_t bytes = 0;
+	pthread_mutex_lock(&stack_mutex);
+	for (size_t ii = min_stack_class; ii <= max_stack_class; ++ii) {
+		if (stack_arenas[ii]) {
+			bytes += stack_arenas[ii]->resident();
+		}
+	}
+	pthread_mutex_unlock(&stack_mutex);
+	return bytes;
+#endif
+}
+
+bool Coroutine::set_stack_reserve(size_t count) {
+#ifdef CORO_FIBER
+	return count == 0;
+#else
+	size_t stack_class = size_class(stack_size);
+	get_stack_arena(stack_class);
+	pthread_mutex_lock(&stack_mutex);
+	stack_reserve = count;
+	stack_reserve_class = stack_class;
+	stack_reserve_prefault = stack_watermark;
+	bool ok = true;
+	if (count && !stack_reserve_thread) {
+		pthread_t thread;
+		pthread_attr_t attr;
+		pthread_attr_init(&attr);
+		pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+		stack_reserve_thread = ok = pthread_create(&thread, &attr, stack_reserve_main, NULL) == 0;
+		pthread_attr_destroy(&attr);
+	}
+	pthread_cond_signal(&stack_reserve_cond);
+	pthread_mutex_unlock(&stack_mutex);
+	return ok;
+#endif
+}
+
+size_t Coroutine::get_stack_reserve() {
+	return stack_reserve;
+}
+
+void Coroutine::set_stack_budget(size_t bytes) {
+	pthread_mutex_lock(&stack_mutex);
+	stack_budget = bytes;
+	pthread_mutex_unlock(&stack_mutex);
+}
+
+size_t Coroutine::get_stack_budget() {
+	return stack_budget;
+}
+
+size_t Coroutine::stack_in_use() {
+	pthread_mutex_lock(&stack_mutex);
+	size_t bytes = stack_bytes_in_use;
+	pthread_mutex_unlock(&stack_mutex);
+	return bytes;
+}
+
 void Coroutine::trampoline(void* that) {
 #ifdef CORO_PTHREAD
-	pthread_setspecific(coro_thread_key, that);
+	current_coroutine = static_cast<Coroutine*>(that);
 #endif
 #ifdef CORO_FIBER
 	// I can't figure out how to get the precise base of the stack in Windows. Since CreateFiber
 	// creates the stack automatically we don't have access to the base. We can however grab the
 	// current esp position, and use that as an approximation. Padding is added for safety since the
 	// base is slightly different.
-	static_cast<Coroutine*>(that)->stack_base = (size_t*)_AddressOfReturnAddress() - stack_size + 16;
+	static_cast<Coroutine*>(that)->stack_base = (size_t*)_AddressOfReturnAddress() - ((size_t)1 << static_cast<Coroutine*>(that)->stack_class) + 16;
 #endif
 	if (!fls_data_pool.empty()) {
 		pthread_setspecific(thread_data_key, fls_data_pool.back());
@@ -196,42 +723,170 @@ void Coroutine::trampoline(void* that) {
 }
 
 Coroutine::Coroutine() :
-	fls_data(v8_tls_keys),
+	fls_data(),
 	entry(NULL),
-	arg(NULL) {
+	arg(NULL),
+	stack_class(0) {
 	stack.sptr = NULL;
 	coro_create(&context, NULL, NULL, NULL, 0);
 }
 
-Coroutine::Coroutine(entry_t& entry, void* arg) :
-	fls_data(v8_tls_keys),
+Coroutine::Coroutine(entry_t& entry, void* arg, size_t stack_class) :
+	fls_data(),
 	entry(entry),
-	arg(arg) {
+	arg(arg),
+	stack_class(stack_class) {
 }
 
 Coroutine::~Coroutine() {
-	if (stack.sptr) {
-		coro_stack_free(&stack);
-	}
+	// With CORO_PTHREAD the context is a thread parked on this stack, so it has to go first
 #ifdef CORO_FIBER
 	if (context.fiber)
 #endif
 	(void)coro_destroy(&context);
+	if (stack.sptr) {
+		stack_arenas[stack_class]->free(stack);
+	}
+}
+
+/**
+ * Number of coroutines the pool may hold right now.
+ */
+static inline size_t pool_limit() {
+	return pool_grown > Coroutine::pool_size ? pool_grown : Coroutine::pool_size;
 }
 
-Coroutine* Coroutine::create_fiber(entry_t* entry, void* arg) {
-	if (!fiber_pool.empty()) {
-		Coroutine* fiber = fiber_pool.back();
-		fiber_pool.pop_back();
+Coroutine* Coroutine::create_fiber(entry_t* entry, void* arg, size_t stack_size) {
+	size_t stack_class = size_class(stack_size ? stack_size : ::stack_size);
+	vector<Coroutine*>& pool = fiber_pool[stack_class];
+	Coroutine* fiber;
+	if (!pool.empty()) {
+		fiber = pool.back();
+		pool.pop_back();
+		--pooled;
+		if (fiber_pool_trimmed[stack_class] > pool.size()) {
+			fiber_pool_trimmed[stack_class] = pool.size();
+		}
 		fiber->reset(entry, arg);
-		return fiber;
+		++pool_hits_;
+	} else if (!(fiber = create(entry, arg, stack_class))) {
+		return NULL;
+	} else {
+		++pool_misses_;
+	}
+	if (++running > running_peak) {
+		running_peak = running;
+		if (running > pool_grown) {
+			pool_grown = running < pool_max_size ? running : pool_max_size;
+		}
 	}
-	Coroutine* coro = new Coroutine(*entry, arg);
-	if (!coro_stack_alloc(&coro->stack, stack_size)) {
+	return fiber;
+}
+
+/**
+ * Entry for pooled coroutines which are being thrown away. finish() takes care of v8's thread data
+ * and deletion, but it has to be called from the coroutine itself.
+ */
+static void drain_entry(void* isolate) {
+	Coroutine::current().finish(*drain_next, static_cast<v8::Isolate*>(isolate));
+}
+
+size_t Coroutine::drain_pool(v8::Isolate* isolate, size_t limit) {
+	size_t released = 0;
+	drain_next = &current();
+	for (size_t ii = min_stack_class; ii <= max_stack_class && pooled > limit; ++ii) {
+		// Oldest first, they're the least likely to have warm stacks. They come off the bottom of the
+		// pool in one go rather than one erase() each.
+		vector<Coroutine*>& pool = fiber_pool[ii];
+		size_t count = pool.size() < pooled - limit ? pool.size() : pooled - limit;
+		vector<Coroutine*> drained(pool.begin(), pool.begin() + count);
+		pool.erase(pool.begin(), pool.begin() + count);
+		pooled -= count;
+		fiber_pool_trimmed[ii] = fiber_pool_trimmed[ii] > count ? fiber_pool_trimmed[ii] - count : 0;
+		for (size_t jj = 0; jj < drained.size(); ++jj) {
+			++running;
+			drained[jj]->reset(drain_entry, isolate);
+			drained[jj]->run();
+			++released;
+		}
+	}
+	drain_next = NULL;
+	return released;
+}
+
+bool Coroutine::decay_pool(v8::Isolate* isolate) {
+	// Shrink to the busiest it's been since last time
+	if (running_peak < pool_grown) {
+		pool_grown = running_peak;
+	}
+	running_peak = running;
+	drain_pool(isolate, pool_limit());
+	return pool_grown > pool_size;
+}
+
+// Stack which admit() took out of the budget for the coroutine that's about to be created. Other
+// threads share the budget, so it can't just be checked now and allocated later.
+static ISOLATE_LOCAL coro_stack admitted_stack;
+static ISOLATE_LOCAL size_t admitted_class = 0;
+
+bool Coroutine::admit(size_t stack_size, v8::Isolate* isolate) {
+	size_t stack_class = size_class(stack_size ? stack_size : ::stack_size);
+	if (!stack_budget || !fiber_pool[stack_class].empty()) {
+		return true;
+	}
+	if (admitted_stack.sptr) {
+		if (admitted_class == stack_class) {
+			return true;
+		}
+		get_stack_arena(admitted_class)->free(admitted_stack);
+	}
+	// Pooled coroutines of other sizes count against the budget too, so make room by throwing them
+	// away first
+	StackArena* arena = get_stack_arena(stack_class);
+	while (true) {
+		bool over_budget = false;
+		if (arena->alloc(admitted_stack, &over_budget)) {
+			admitted_class = stack_class;
+			return true;
+		} else if (!over_budget) {
+			// Out of memory rather than budget, create() will run into it too and say so
+			return true;
+		} else if (!pooled) {
+			return false;
+		}
+		drain_pool(isolate, pooled - 1);
+	}
+}
+
+size_t Coroutine::trim(v8::Isolate* isolate) {
+	pool_grown = 0;
+	running_peak = running;
+	size_t released = drain_pool(isolate, 0);
+#ifndef CORO_FIBER
+	pthread_mutex_lock(&stack_mutex);
+	for (size_t ii = min_stack_class; ii <= max_stack_class; ++ii) {
+		if (stack_arenas[ii]) {
+			stack_arenas[ii]->release_reserve();
+		}
+	}
+	pthread_mutex_unlock(&stack_mutex);
+#endif
+	return released;
+}
+
+Coroutine* Coroutine::create(entry_t* entry, void* arg, size_t stack_class) {
+	Coroutine* coro = new Coroutine(*entry, arg, stack_class);
+	if (admitted_stack.sptr && admitted_class == stack_class) {
+		coro->stack = admitted_stack;
+		admitted_stack.sptr = NULL;
+	} else if (!get_stack_arena(stack_class)->alloc(coro->stack)) {
 		delete coro;
 		return NULL;
 	}
-	coro_create(&coro->context, trampoline, coro, coro->stack.sptr, coro->stack.ssze);
+	{
+		std::lock_guard<std::mutex> lock(coro_create_mutex);
+		coro_create(&coro->context, trampoline, coro, coro->stack.sptr, coro->stack.ssze);
+	}
 #ifdef CORO_FIBER
 	// Stupid hack. libcoro's project structure combined with Windows's CreateFiber functions makes
 	// it difficult to catch this error. Sometimes Windows will return `ERROR_NOT_ENOUGH_MEMORY` or
@@ -247,29 +902,61 @@ Coroutine* Coroutine::create_fiber(entry_t* entry, void* arg) {
 	return coro;
 }
 
+/**
+ * Placeholder entry for prewarmed coroutines, which are always reset before they first run.
+ */
+static void prewarm_entry(void* arg) {
+	assert(false);
+}
+
+size_t Coroutine::prewarm(size_t count, size_t stack_size) {
+	size_t stack_class = size_class(stack_size ? stack_size : ::stack_size);
+	vector<Coroutine*>& pool = fiber_pool[stack_class];
+	vector<Coroutine*> added;
+	while (added.size() < count && pooled + added.size() < pool_limit()) {
+		Coroutine* coro = create(prewarm_entry, NULL, stack_class);
+		if (!coro) {
+			break;
+		}
+		stack_arenas[stack_class]->prefault(coro->stack, stack_watermark);
+		added.push_back(coro);
+	}
+	// New stacks go to the bottom so the pool's hot end stays hot
+	pool.insert(pool.begin(), added.begin(), added.end());
+	fiber_pool_trimmed[stack_class] += added.size();
+	pooled += added.size();
+	return added.size();
+}
+
 void Coroutine::reset(entry_t* entry, void* arg) {
 	assert(entry != NULL);
 	this->entry = entry;
 	this->arg = arg;
 }
 
+/**
+ * Saves the current value of a v8 thread local and installs the incoming coroutine's value. Most
+ * switches leave at least the isolate untouched so the write is skipped when nothing changes.
+ */
+static inline void swap_tls(pthread_key_t key, void*& save, void* restore) {
+	save = pthread_getspecific(key);
+	if (save != restore) {
+		pthread_setspecific(key, restore);
+	}
+}
+
 void Coroutine::transfer(Coroutine& next) {
 	assert(this != &next);
 #ifndef CORO_PTHREAD
-	fls_data[0] = pthread_getspecific(isolate_key);
-	fls_data[1] = pthread_getspecific(thread_id_key);
-	fls_data[2] = pthread_getspecific(thread_data_key);
-
-	pthread_setspecific(isolate_key, next.fls_data[0]);
-	pthread_setspecific(thread_id_key, next.fls_data[1]);
-	pthread_setspecific(thread_data_key, next.fls_data[2]);
+	swap_tls(isolate_key, fls_data[0], next.fls_data[0]);
+	swap_tls(thread_id_key, fls_data[1], next.fls_data[1]);
+	swap_tls(thread_data_key, fls_data[2], next.fls_data[2]);
 
-	pthread_setspecific(coro_thread_key, &next);
+	// Whoever transfers back into this coroutine sets `current_coroutine` for us
+	current_coroutine = &next;
 #endif
+	++switches_;
 	coro_transfer(&context, &next.context);
-#ifndef CORO_PTHREAD
-	pthread_setspecific(coro_thread_key, this);
-#endif
 }
 
 void Coroutine::run() {
@@ -285,6 +972,7 @@ void Coroutine::run() {
 		assert(delete_me == this);
 		assert(&current != this);
 		delete_me = NULL;
+		++coroutines_destroyed_;
 		delete this;
 	}
 }
@@ -293,8 +981,29 @@ void Coroutine::finish(Coroutine& next, v8::Isolate* isolate) {
 	{
 		assert(&next != this);
 		assert(&current() == this);
-		if (fiber_pool.size() < pool_size) {
-			fiber_pool.push_back(this);
+		--running;
+		if (stack_tracking && !drain_next) {
+			stack_usage_finished = stack_usage();
+			size_t bucket = 0;
+			while (bucket < stack_usage_buckets - 1 && stack_usage_finished > ((size_t)4096 << bucket)) {
+				++bucket;
+			}
+			++stack_usage_counts[bucket];
+		}
+		if (!drain_next && pooled < pool_limit()) {
+			if (stack_tracking) {
+				stack_arenas[stack_class]->scrub(stack, stack_usage_finished);
+			}
+			vector<Coroutine*>& pool = fiber_pool[stack_class];
+			pool.push_back(this);
+			++pooled;
+			// Trim stacks in batches once they're buried in the pool
+			size_t& trimmed = fiber_pool_trimmed[stack_class];
+			if (pool.size() >= trimmed + 2 * fiber_pool_hot) {
+				for (; trimmed < pool.size() - fiber_pool_hot; ++trimmed) {
+					stack_arenas[stack_class]->trim(pool[trimmed]->stack, stack_watermark);
+				}
+			}
 		} else {
 #if V8_MAJOR_VERSION > 4 || (V8_MAJOR_VERSION == 4 && V8_MINOR_VERSION >= 10)
 			// Clean up isolate data
@@ -314,6 +1023,37 @@ void Coroutine::finish(Coroutine& next, v8::Isolate* isolate) {
 	this->transfer(next);
 }
 
+void Coroutine::discard() {
+	assert(&current() != this);
+	--running;
+	++coroutines_destroyed_;
+	delete this;
+}
+
+size_t Coroutine::stack_usage() const {
+	return stack.sptr ? stack_arenas[stack_class]->used(stack) : 0;
+}
+
+void Coroutine::set_stack_tracking(bool enabled, v8::Isolate* isolate) {
+	if (enabled && !stack_tracking) {
+		// Pooled stacks may have been used without being scrubbed
+		drain_pool(isolate, 0);
+	}
+	stack_tracking = enabled;
+}
+
+bool Coroutine::get_stack_tracking() {
+	return stack_tracking;
+}
+
+size_t Coroutine::finished_stack_usage() {
+	return stack_usage_finished;
+}
+
+const size_t* Coroutine::stack_usage_histogram() {
+	return stack_usage_counts;
+}
+
 void* Coroutine::bottom() const {
 #ifdef CORO_FIBER
 	return stack_base;
@@ -323,5 +1063,5 @@ void* Coroutine::bottom() const {
 }
 
 size_t Coroutine::size() const {
-	return sizeof(Coroutine) + stack_size * sizeof(void*);
+	return sizeof(Coroutine) + ((size_t)1 << stack_class) * sizeof(void*);
 }
@@ -3,19 +3,40 @@
 #include <vector>
 #include "libcoro/coro.h"
 
+// State of the fiber runtime. Each isolate runs on a thread of its own, so thread locals make it
+// per isolate. With CORO_PTHREAD every coroutine is a thread as well, so the state has to be shared
+// by the whole process and only one isolate may use fibers.
+#ifdef CORO_PTHREAD
+#define ISOLATE_LOCAL
+#else
+#define ISOLATE_LOCAL thread_local
+#endif
+
 class Coroutine {
 	public:
 		typedef void(entry_t)(void*);
 
+		// Stacks are pooled by power-of-two size classes, from 64kb to 2^24 words. v8 won't compile
+		// a function with less than ~40kb of stack to spare, so there's no use in going smaller.
+		static const size_t min_stack_class = sizeof(void*) == 8 ? 13 : 14;
+		static const size_t max_stack_class = 24;
+
+		// Stack usage histogram buckets; bucket `n` counts usage up to 4kb << n
+		static const size_t stack_usage_buckets = 16;
+
 	private:
+		// Number of v8 thread locals which are swapped with each coroutine
+		static const size_t v8_tls_keys = 3;
+
 #ifdef CORO_FIBER
 		void* stack_base;
 #endif
 		coro_context context;
 		coro_stack stack;
-		std::vector<void*> fls_data;
+		void* fls_data[v8_tls_keys];
 		entry_t* entry;
 		void* arg;
+		size_t stack_class;
 
 		~Coroutine();
 
@@ -30,18 +51,45 @@ class Coroutine {
 		 * This constructor will actually create a new fiber context. Execution does not begin
 		 * until you call run() for the first time.
 		 */
-		Coroutine(entry_t& entry, void* arg);
+		Coroutine(entry_t& entry, void* arg, size_t stack_class);
 
 		/**
 		 * Resets the context of this coroutine from the start. Used to recyle old coroutines.
 		 */
 		void reset(entry_t* entry, void* arg);
 
+		/**
+		 * Allocates a brand new coroutine, bypassing the pool.
+		 */
+		static Coroutine* create(entry_t* entry, void* arg, size_t stack_class);
+
 		static void trampoline(void* that);
 		void transfer(Coroutine& next);
 
+		/**
+		 * Throws away pooled coroutines until there are no more than `limit` left. Returns how many
+		 * were released.
+		 */
+		static size_t drain_pool(v8::Isolate* isolate, size_t limit);
+
+		/**
+		 * Returns the smallest size class which can hold a stack of `size` words.
+		 */
+		static size_t size_class(size_t size);
+
 	public:
-		static size_t pool_size;
+		/**
+		 * The pool always keeps up to `pool_size` coroutines. When more than that run at once it
+		 * grows to match, up to `pool_max_size`, and decay_pool() shrinks it back again.
+		 */
+		static ISOLATE_LOCAL size_t pool_size;
+		static ISOLATE_LOCAL size_t pool_max_size;
+
+		/**
+		 * Bytes at the top of a pooled coroutine's stack which are kept resident. The rest is given
+		 * back to the OS when the coroutine goes back in the pool.
+		 */
+		static ISOLATE_LOCAL size_t stack_watermark;
 
 		/**
 		 * Returns the currently-running fiber.
@@ -49,27 +97,105 @@ class Coroutine {
 		static Coroutine& current();
 
 		/**
-		 * Create a new fiber.
+		 * Create a new fiber. `stack_size` is measured in sizeof(void*) and rounded up to the next
+		 * size class; 0 uses the default size.
+		 */
+		static Coroutine* create_fiber(entry_t* entry, void* arg = NULL, size_t stack_size = 0);
+
+		/**
+		 * Fills the pool with up to `count` new coroutines so that create_fiber() doesn't have to
+		 * allocate later. Stops when the pool is full; returns how many were added.
 		 */
-		static Coroutine* create_fiber(entry_t* entry, void* arg = NULL);
+		static size_t prewarm(size_t count, size_t stack_size = 0);
 
 		/**
-		 * Initialize the library.
+		 * Called periodically to shrink the pool to the most coroutines which were running at once
+		 * since the last call. Returns true if the pool is still larger than `pool_size`.
+		 */
+		static bool decay_pool(v8::Isolate* isolate);
+
+		/**
+		 * Releases every pooled coroutine and reserved stack, for when memory is tight. Returns the
+		 * number of coroutines released.
+		 */
+		static size_t trim(v8::Isolate* isolate);
+
+		/**
+		 * Initialize the library for the calling thread. Every thread with an isolate that uses
+		 * coroutines calls this once; they each get their own pool and counters.
 		 */
 		static void init(v8::Isolate* isolate);
 
 		/**
-		 * Set the size of coroutines created by this library. Since coroutines are pooled the stack
-		 * size is global instead of per-coroutine. Stack is measured in sizeof(void*), so
-		 * set_stack_size(128) -> 512 bytes or 1kb
+		 * Set the default stack size of coroutines created by this thread. This can only be changed
+		 * before the thread creates its first coroutine, and not to another size class while stacks
+		 * of the current one are reserved; returns false otherwise. Stack is measured in
+		 * sizeof(void*), so set_stack_size(128) -> 512 bytes or 1kb
+		 */
+		static bool set_stack_size(size_t size);
+
+		/**
+		 * Returns the default stack size, in sizeof(void*).
 		 */
-		static void set_stack_size(unsigned int size);
+		static size_t get_stack_size();
+
+		/**
+		 * Largest stack size which may be passed to create_fiber(), in sizeof(void*).
+		 */
+		static size_t max_stack_size();
 
 		/**
 		 * Get the number of coroutines that have been created.
 		 */
 		static size_t coroutines_created();
 
+		/**
+		 * Counters for Fiber.stats(): coroutines destroyed, create_fiber() calls which did and
+		 * didn't find one in the pool, how many are in the pool now and the number of context
+		 * switches.
+		 */
+		static size_t coroutines_destroyed();
+		static size_t pool_hits();
+		static size_t pool_misses();
+		static size_t pool_count();
+		static size_t switches();
+
+		/**
+		 * Bytes of address space reserved for fiber stacks, and how much of that has been made
+		 * accessible to fibers.
+		 */
+		static size_t stack_reserved();
+		static size_t stack_committed();
+
+		/**
+		 * Bytes of fiber stacks which are actually resident in memory. This has to ask the OS so
+		 * it's not cheap.
+		 */
+		static size_t stack_resident();
+
+		/**
+		 * Keep `count` default-sized stacks mapped and faulted in by a helper thread, so that new
+		 * fibers don't have to wait on the OS. 0 turns this off. Returns false if the thread can't
+		 * be started.
+		 */
+		static bool set_stack_reserve(size_t count);
+		static size_t get_stack_reserve();
+
+		/**
+		 * Limit on the bytes of stack held by coroutines, pooled or not, and the reserve. Stacks
+		 * which have been released back to the OS don't count. 0 means no limit.
+		 */
+		static void set_stack_budget(size_t bytes);
+		static size_t get_stack_budget();
+		static size_t stack_in_use();
+
+		/**
+		 * Returns true if a coroutine with this stack size can be created without going over the
+		 * stack budget. Pooled coroutines of other sizes may be released to make room. The stack is
+		 * taken out of the budget right away and the next create_fiber() of that size gets it.
+		 */
+		static bool admit(size_t stack_size, v8::Isolate* isolate);
+
 		/**
 		 * Start or resume execution in this fiber. Note there is no explicit yield() function,
 		 * you must manually run another fiber.
@@ -83,6 +209,28 @@ class Coroutine {
 		 */
 		void finish(Coroutine& next, v8::Isolate* isolate);
 
+		/**
+		 * Frees a suspended coroutine which will never be resumed, because its isolate is going away.
+		 * Nothing on its stack is unwound.
+		 */
+		void discard();
+
+		/**
+		 * Stack usage tracking. When enabled each coroutine's high-water mark is measured when it
+		 * finishes, and its stack is zeroed for the next run. stack_usage() measures this coroutine's
+		 * stack right now, which is only meaningful with tracking on.
+		 */
+		static void set_stack_tracking(bool enabled, v8::Isolate* isolate);
+		static bool get_stack_tracking();
+		size_t stack_usage() const;
+
+		/**
+		 * High-water mark of the coroutine which finished last, and counts of all of them
+		 * (`stack_usage_buckets` long).
+		 */
+		static size_t finished_stack_usage();
+		static const size_t* stack_usage_histogram();
+
 		/**
 		 * Returns address of the lowest usable byte in this Coroutine's stack.
 		 */
@@ -1,9 +1,15 @@
 #include "coroutine.h"
 #include "v8-version.h"
 #include <assert.h>
+#include <math.h>
+#include <string.h>
 #include <node.h>
 #include <node_version.h>
+#include <uv.h>
+#include <v8-profiler.h>
 
+#include <deque>
+#include <memory>
 #include <vector>
 #include <iostream>
 
@@ -124,9 +130,89 @@ namespace uni {
 	}
 #endif
 
+#if V8_AT_LEAST(7, 1)
+	bool ToBoolean(Isolate* isolate, Local<Value> value) {
+		return value->BooleanValue(isolate);
+	}
+#elif V8_AT_LEAST(4, 4)
+	bool ToBoolean(Isolate* isolate, Local<Value> value) {
+		return value->BooleanValue(isolate->GetCurrentContext()).FromJust();
+	}
+#else
+	bool ToBoolean(Isolate* isolate, Handle<Value> value) {
+		return value->BooleanValue();
+	}
+#endif
+
+#if V8_AT_LEAST(9, 2)
+	Local<Context> GetCreationContext(Local<Object> object) {
+		return object->GetCreationContext().ToLocalChecked();
+	}
+#else
+	Local<Context> GetCreationContext(Local<Object> object) {
+		return object->CreationContext();
+	}
+#endif
+
+#if V8_AT_LEAST(8, 0)
+	void* GetData(Local<ArrayBuffer> buffer) {
+		return buffer->GetBackingStore()->Data();
+	}
+#else
+	void* GetData(Local<ArrayBuffer> buffer) {
+		return buffer->GetContents().Data();
+	}
+#endif
+
+#if V8_AT_LEAST(4, 4)
+	// A Float64Array over `length` doubles owned by v8. `data` is where they live.
+	Local<Object> NewFloat64Array(Isolate* isolate, size_t length, double** data) {
+		Local<ArrayBuffer> buffer = ArrayBuffer::New(isolate, length * sizeof(double));
+		*data = static_cast<double*>(GetData(buffer));
+		return Float64Array::New(buffer, 0, length);
+	}
+#else
+	// No typed arrays to speak of, but indexed properties can be backed by external memory. It's
+	// never freed, which is fine for an array that lives as long as the process.
+	Local<Object> NewFloat64Array(Isolate* isolate, size_t length, double** data) {
+		Local<Object> array = Object::New();
+		*data = new double[length]();
+		array->SetIndexedPropertiesToExternalArrayData(*data, kExternalDoubleArray, length);
+		return array;
+	}
+#endif
+
+#if V8_AT_LEAST(6, 8)
+	void AddNearHeapLimitCallback(Isolate* isolate, NearHeapLimitCallback callback) {
+		isolate->AddNearHeapLimitCallback(callback, NULL);
+	}
+
+	void RemoveNearHeapLimitCallback(Isolate* isolate, NearHeapLimitCallback callback, size_t heap_limit) {
+		isolate->RemoveNearHeapLimitCallback(callback, heap_limit);
+	}
+#else
+	// Older versions of v8 don't say when the heap is nearly full, and its limit stays put
+	typedef size_t (*NearHeapLimitCallback)(void* data, size_t current_heap_limit, size_t initial_heap_limit);
+	void AddNearHeapLimitCallback(Isolate* isolate, NearHeapLimitCallback callback) {}
+	void RemoveNearHeapLimitCallback(Isolate* isolate, NearHeapLimitCallback callback, size_t heap_limit) {}
+#endif
+
+#if NODE_VERSION_AT_LEAST(9, 0, 0)
+	// Calls `method` with no async resource around it, like a callback straight from the event loop
+	void MakeCallback(Isolate* isolate, Local<Object> recv, const char* method, int argc, Local<Value>* argv) {
+		node::MakeCallback(isolate, recv, method, argc, argv, node::async_context{0, 0});
+	}
+#else
+	void MakeCallback(Isolate* isolate, Local<Object> recv, const char* method, int argc, Local<Value>* argv) {
+		node::MakeCallback(isolate, recv, method, argc, argv);
+	}
+#endif
+
 #if V8_AT_LEAST(6, 1)
 	Local<Value> GetStackTrace(TryCatch* try_catch, Local<Context> context) {
-		return try_catch->StackTrace(context).ToLocalChecked();
+		// Primitives don't have a stack
+		Local<Value> stack;
+		return try_catch->StackTrace(context).ToLocal(&stack) ? stack : try_catch->Exception();
 	}
 #else
 	Local<Value> GetStackTrace(TryCatch* try_catch, Handle<Context> context) {
@@ -136,11 +222,10 @@ namespace uni {
 
 // Workaround for v8 issue #1180
 // http://code.google.com/p/v8/issues/detail?id=1180
-// NOTE: it's not clear if this is still necessary (perhaps Isolate::SetStackLimit could be used?)
-#if V8_AT_LEAST(6, 1)
-	void fixStackLimit(Isolate* isolate, Local<Context> context) {
-		Script::Compile(context, uni::NewLatin1String(isolate, "void 0;")).ToLocalChecked();
-	}
+// Only needed when the stack limit goes through ResourceConstraints. Isolate::SetStackLimit, used
+// from 3.29 on, applies the new limit right away so there's no reason to compile anything.
+#if V8_AT_LEAST(3, 29)
+	void fixStackLimit(Isolate* isolate, Local<Context> context) {}
 #else
 	void fixStackLimit(Isolate* isolate, Handle<Context> context) {
 		Script::Compile(uni::NewLatin1String(isolate, "void 0;"));
@@ -185,6 +270,10 @@ namespace uni {
 	Local<T> Deref(Isolate* isolate, Persistent<T>& handle) {
 		return Local<T>::New(isolate, handle);
 	}
+	template <class T>
+	Local<T> Deref(Isolate* isolate, Local<T> handle) {
+		return Local<T>::New(isolate, handle);
+	}
 
 	template <class T>
 	void Return(Local<T> handle, const Arguments& args) {
@@ -289,6 +378,10 @@ namespace uni {
 	Handle<T> Deref(Isolate* isolate, Persistent<T>& handle) {
 		return Local<T>::New(handle);
 	}
+	template <class T>
+	Handle<T> Deref(Isolate* isolate, Local<T> handle) {
+		return Local<T>::New(handle);
+	}
 
 	Handle<Value> Return(Handle<Value> handle, GetterCallbackInfo info) {
 		return handle;
@@ -395,60 +488,231 @@ namespace uni {
 #endif
 }
 
+/**
+ * Log-linear histogram in the style of HdrHistogram. Values below 2^sub_bits land in their own
+ * bucket, above that every power of two is split into 2^sub_bits buckets so each bucket is within
+ * about 3% of the values it holds. Recording is a few shifts and an increment.
+ */
+class LatencyHistogram {
+	private:
+		static const int sub_bits = 5;
+		static const size_t sub_count = 1 << sub_bits;
+		static const size_t bucket_count = (64 - sub_bits + 1) * sub_count;
+		uint64_t buckets[bucket_count];
+		uint64_t total;
+		uint64_t sum;
+		uint64_t lowest;
+		uint64_t highest;
+
+		static size_t index_of(uint64_t value) {
+			size_t shift = 0;
+			while ((value >> shift) >= sub_count * 2) {
+				++shift;
+			}
+			if (shift == 0) {
+				return value;
+			}
+			return (shift + 1) * sub_count + (size_t)(value >> shift) - sub_count;
+		}
+
+		// Highest value which falls into bucket `index`
+		static uint64_t value_of(size_t index) {
+			if (index < sub_count * 2) {
+				return index;
+			}
+			size_t shift = index / sub_count - 1;
+			uint64_t top = index % sub_count + sub_count;
+			return ((top + 1) << shift) - 1;
+		}
+
+	public:
+		LatencyHistogram() {
+			reset();
+		}
+
+		void reset() {
+			memset(buckets, 0, sizeof(buckets));
+			total = sum = highest = 0;
+			lowest = ~(uint64_t)0;
+		}
+
+		void record(uint64_t value) {
+			++buckets[index_of(value)];
+			++total;
+			sum += value;
+			if (value < lowest) {
+				lowest = value;
+			}
+			if (value > highest) {
+				highest = value;
+			}
+		}
+
+		uint64_t count() const { return total; }
+		uint64_t min() const { return total ? lowest : 0; }
+		uint64_t max() const { return highest; }
+		double mean() const { return total ? (double)sum / total : 0; }
+
+		/**
+		 * Smallest bucket value which at least `percentile`% of recorded values are at or below
+		 */
+		uint64_t percentile(double percentile) const {
+			uint64_t rank = (uint64_t)ceil(percentile / 100 * total);
+			if (rank == 0) {
+				rank = 1;
+			}
+			uint64_t seen = 0;
+			for (size_t ii = 0; ii < bucket_count; ++ii) {
+				seen += buckets[ii];
+				if (seen >= rank) {
+					uint64_t value = value_of(ii);
+					return value < highest ? value : highest;
+				}
+			}
+			return highest;
+		}
+};
+
 class Fiber {
 
 	private:
-		static Locker* global_locker; // Node does not use locks or threads, so we need a global lock
-		static Persistent<FunctionTemplate> tmpl;
-		static Persistent<Function> fiber_object;
-		static Fiber* current;
-		static vector<Fiber*> orphaned_fibers;
-		static Persistent<Value> fatal_stack;
+		// Everything here is per isolate. Node runs each isolate on a thread of its own, the main
+		// thread or a worker's, and a fiber never leaves the thread it was created on, so thread
+		// locals are enough to give every worker its own fibers.
+		static ISOLATE_LOCAL Locker* global_locker; // Node's main thread doesn't hold a Locker, so we need one
+		static ISOLATE_LOCAL Persistent<FunctionTemplate> tmpl;
+		static ISOLATE_LOCAL Persistent<Function> fiber_object;
+		static ISOLATE_LOCAL Fiber* current;
+		static ISOLATE_LOCAL Fiber* live_fibers; // Every Fiber object, for heap snapshots
+		static ISOLATE_LOCAL deque<Fiber*> orphaned_fibers;
+		static ISOLATE_LOCAL uv_idle_t* orphan_idle;
+		static ISOLATE_LOCAL uint64_t orphan_budget; // nanoseconds of unwinding per event loop iteration
+		static const size_t orphan_backlog_limit = 250; // beyond this run() helps unwind
+		static ISOLATE_LOCAL Persistent<Value> fatal_stack;
+		static ISOLATE_LOCAL Persistent<Value> zombie_exception; // Thrown into every fiber being unwound
+		static ISOLATE_LOCAL uv_timer_t* pool_timer;
+		static ISOLATE_LOCAL uint64_t pool_idle_time;
+		static ISOLATE_LOCAL uv_async_t* trim_async;
+		static ISOLATE_LOCAL size_t heap_limit; // Limit to go back to after a trim, 0 if not raised
+		static ISOLATE_LOCAL bool trim_pending; // Set by NearHeapLimit() for the next full collection
+		static const size_t heap_limit_bump = 16 * 1024 * 1024;
+
+		// Counters for Fiber.stats(), which are copied into `stats_buffer` on demand
+		static ISOLATE_LOCAL size_t fibers_live;
+		static ISOLATE_LOCAL size_t fibers_started;
+		static ISOLATE_LOCAL size_t fibers_yielding;
+		static ISOLATE_LOCAL size_t orphans_queued;
+		static ISOLATE_LOCAL size_t orphans_unwound;
+		static const size_t stats_count = 14;
+		static const char* const stats_fields[stats_count];
+		static ISOLATE_LOCAL double* stats_buffer; // Backing store of `stats_array`
+		static ISOLATE_LOCAL Persistent<Object> stats_array;
+
+		// Stack bytes held by started fibers, and how much of that v8 has been told about
+		static ISOLATE_LOCAL int64_t stack_bytes_live;
+		static ISOLATE_LOCAL int64_t stack_bytes_reported;
+
+		// Context switch timing for Fiber.switchLatency(). `switch_began` is stamped by whichever side
+		// gives up control and consumed by whichever side resumes.
+		static ISOLATE_LOCAL bool switch_timing;
+		static ISOLATE_LOCAL uint64_t switch_began;
+		static ISOLATE_LOCAL LatencyHistogram switch_latency;
+
+		// Fibers waiting for room in the stack budget, oldest first
+		struct QueuedRun {
+			Fiber* fiber;
+			Persistent<Value> param;
+			bool has_param;
+		};
+		static ISOLATE_LOCAL bool budget_queue;
+		static ISOLATE_LOCAL deque<QueuedRun*> run_queue;
+		static ISOLATE_LOCAL Fiber* admitting;
+		static ISOLATE_LOCAL uv_idle_t* admit_idle;
+
+		// Handed from run() to RunFiber() when a fiber starts. Reading them off the Fiber object from
+		// the new stack would leave a handle to the object there for good, and an abandoned fiber
+		// could never be collected.
+		static ISOLATE_LOCAL Local<Function> starting_cb;
+		static ISOLATE_LOCAL Local<Context> starting_context;
+
+		// Internal fields of a Fiber object. The function and the global object of the context the
+		// fiber was created in live here instead of in Persistents of their own, so the only global
+		// handle a fiber holds for its whole life is the weak one to its object. Tens of thousands of
+		// suspended fibers otherwise add a measurable amount to every GC pause.
+		enum { field_fiber, field_cb, field_global, field_count };
 
 		Isolate* isolate;
 		Persistent<Object> handle;
-		Persistent<Function> cb;
-		Persistent<Context> v8_context;
-		Persistent<Value> zombie_exception;
-		Persistent<Value> yielded;
-		bool yielded_exception;
+		Persistent<Value> returned;
+		Local<Value> yielded;
 		Coroutine* entry_fiber;
 		Coroutine* this_fiber;
+		Fiber* prev_live;
+		Fiber* next_live;
+		size_t stack_size;
+		size_t stack_usage;
+		bool yielded_exception;
 		bool started;
 		bool yielding;
 		bool zombie;
 		bool resetting;
+		bool queued;
 
 		static Fiber& Unwrap(Local<Object> handle) {
 			assert(!handle.IsEmpty());
-			assert(handle->InternalFieldCount() == 1);
-			return *static_cast<Fiber*>(uni::GetInternalPointer(handle, 0));
+			assert(handle->InternalFieldCount() == field_count);
+			return *static_cast<Fiber*>(uni::GetInternalPointer(handle, field_fiber));
 		}
 
-		Fiber(Local<Object> handle, Local<Function> cb, Local<Context> v8_context) :
+		Local<Function> GetCallback() {
+			return Local<Function>::Cast(uni::Deref(isolate, handle)->GetInternalField(field_cb));
+		}
+
+		Local<Context> GetContext() {
+			return uni::GetCreationContext(Local<Object>::Cast(uni::Deref(isolate, handle)->GetInternalField(field_global)));
+		}
+
+		Fiber(Local<Object> handle, Local<Function> cb, Local<Context> v8_context, size_t stack_size) :
 			isolate(Isolate::GetCurrent()),
+			prev_live(NULL),
+			next_live(live_fibers),
+			stack_size(stack_size),
+			stack_usage(0),
 			started(false),
 			yielding(false),
 			zombie(false),
-			resetting(false) {
+			resetting(false),
+			queued(false) {
 			uni::Reset(isolate, this->handle, handle);
-			uni::Reset(isolate, this->cb, cb);
-			uni::Reset(isolate, this->v8_context, v8_context);
 
 			MakeWeak();
-			uni::SetInternalPointer(handle, 0, this);
+			uni::SetInternalPointer(handle, field_fiber, this);
+			handle->SetInternalField(field_cb, cb);
+			handle->SetInternalField(field_global, v8_context->Global());
+			if (live_fibers) {
+				live_fibers->prev_live = this;
+			}
+			live_fibers = this;
+			++fibers_live;
 		}
 
-		virtual ~Fiber() {
+		~Fiber() {
 			assert(!this->started);
+			if (prev_live) {
+				prev_live->next_live = next_live;
+			} else {
+				live_fibers = next_live;
+			}
+			if (next_live) {
+				next_live->prev_live = prev_live;
+			}
+			--fibers_live;
 			uni::Dispose(isolate, handle);
-			uni::Dispose(isolate, cb);
-			uni::Dispose(isolate, v8_context);
 		}
 
 		/**
-		 * Call MakeWeak if it's ok for v8 to garbage collect this Fiber.
-		 * i.e. After fiber completes, while yielded, or before started
+		 * Call MakeWeak if it's ok for v8 to garbage collect this Fiber. The handle is weak for the
+		 * whole life of the fiber; while it is running whoever called `run()` holds it on their stack.
 		 */
 		void MakeWeak() {
 			uni::MakeWeak<WeakCallback>(isolate, handle, (void*)this);
@@ -456,7 +720,7 @@ class Fiber {
 
 		/**
 		 * And call ClearWeak if it's not ok for v8 to garbage collect this Fiber.
-		 * i.e. While running.
+		 * i.e. While an orphan is waiting to be unwound.
 		 */
 		void ClearWeak() {
 			handle.ClearWeak();
@@ -479,7 +743,9 @@ class Fiber {
 			if (that.started) {
 				assert(that.yielding);
 				orphaned_fibers.push_back(&that);
+				++orphans_queued;
 				that.ClearWeak();
+				uv_idle_start(orphan_idle, ReclaimOrphans);
 				return;
 			}
 
@@ -492,37 +758,101 @@ class Fiber {
 		 * collector leads to exponential time garbage collections if there are many orphaned Fibers,
 		 * there's also the possibility of running out of stack space. It's generally bad news.
 		 *
-		 * So instead we have this function to clean up all the fibers after the garbage collection
-		 * has finished.
+		 * So instead we have these functions to clean up the fibers after the garbage collection has
+		 * finished. This one unwinds the oldest orphan.
 		 */
-		static void DestroyOrphans() {
-			if (orphaned_fibers.empty()) {
-				return;
+		static void DestroyOrphan() {
+			Fiber& that = *orphaned_fibers.front();
+			orphaned_fibers.pop_front();
+			Local<Context> v8_context = that.GetContext();
+			v8_context->Enter();
+			that.UnwindStack();
+			v8_context->Exit();
+			++orphans_unwound;
+
+			if (that.yielded_exception) {
+				// If you throw an exception from a fiber that's being garbage collected there's no way
+				// to bubble that exception up to the application.
+				auto stack(uni::Deref(that.isolate, fatal_stack));
+				cerr <<
+					"An exception was thrown from a Fiber which was being garbage collected. This error "
+					"can not be gracefully recovered from. The only acceptable behavior is to terminate "
+					"this application. The exception appears below:\n\n"
+					<<*stack <<"\n";
+				exit(1);
+			} else {
+				uni::Dispose(that.isolate, fatal_stack);
 			}
-			vector<Fiber*> orphans(orphaned_fibers);
-			orphaned_fibers.clear();
 
-			for (vector<Fiber*>::iterator ii = orphans.begin(); ii != orphans.end(); ++ii) {
-				Fiber& that = **ii;
-				that.UnwindStack();
-
-				if (that.yielded_exception) {
-					// If you throw an exception from a fiber that's being garbage collected there's no way
-					// to bubble that exception up to the application.
-					auto stack(uni::Deref(that.isolate, fatal_stack));
-					cerr <<
-						"An exception was thrown from a Fiber which was being garbage collected. This error "
-						"can not be gracefully recovered from. The only acceptable behavior is to terminate "
-						"this application. The exception appears below:\n\n"
-						<<*stack <<"\n";
-					exit(1);
-				} else {
-					uni::Dispose(that.isolate, fatal_stack);
+			uni::Dispose(that.isolate, that.returned);
+			that.MakeWeak();
+		}
+
+		/**
+		 * Unwinds orphans until none are left or, if `budget` is nonzero, until that many nanoseconds
+		 * have passed.
+		 */
+		static void DestroyOrphans(uint64_t budget = 0) {
+			uint64_t deadline = budget ? uv_hrtime() + budget : 0;
+			while (!orphaned_fibers.empty()) {
+				DestroyOrphan();
+				if (deadline && uv_hrtime() >= deadline) {
+					break;
 				}
+			}
+		}
 
-				uni::Dispose(that.isolate, that.yielded);
-				that.MakeWeak();
+		/**
+		 * Unwinds orphans from the event loop a slice at a time, so that a collection which finds
+		 * thousands of them doesn't stall whichever fiber happens to run next. The idle handle keeps
+		 * the loop polling without blocking until the backlog is gone.
+		 */
+		static void ReclaimOrphans(uv_idle_t* handle) {
+			Isolate* isolate = static_cast<Isolate*>(handle->data);
+			uni::HandleScope scope(isolate);
+			DestroyOrphans(orphan_budget);
+			if (orphaned_fibers.empty()) {
+				uv_idle_stop(handle);
+			}
+		}
+
+		/**
+		 * Converts a stack size in bytes from Javascript into sizeof(void*) units. Returns 0 if the
+		 * value is out of range.
+		 */
+		static size_t StackSizeFromBytes(Local<Value> value) {
+			double bytes = uni::ToNumber(value)->Value();
+			if (!(bytes > 0) || bytes > (double)(Coroutine::max_stack_size() * sizeof(void*))) {
+				return 0;
 			}
+			return ((size_t)bytes + sizeof(void*) - 1) / sizeof(void*);
+		}
+
+		/**
+		 * Reads the `stackSize` out of an options object, leaving `stack_size` as 0 if there isn't
+		 * one. Returns false if an exception was thrown.
+		 */
+		static bool GetStackSizeOption(Isolate* isolate, Local<Value> options, size_t& stack_size) {
+			stack_size = 0;
+			if (options->IsUndefined()) {
+				return true;
+			} else if (!options->IsObject()) {
+				uni::ThrowException(isolate, Exception::TypeError(uni::NewLatin1String(isolate, "Fiber options must be an object")));
+				return false;
+			}
+			Local<Value> value;
+			if (!Local<Object>::Cast(options)->Get(isolate->GetCurrentContext(), uni::NewLatin1Symbol(isolate, "stackSize")).ToLocal(&value)) {
+				return false;
+			} else if (value->IsUndefined()) {
+				return true;
+			} else if (!value->IsNumber()) {
+				uni::ThrowException(isolate, Exception::TypeError(uni::NewLatin1String(isolate, "stackSize must be a number")));
+				return false;
+			} else if (!(stack_size = StackSizeFromBytes(value))) {
+				uni::ThrowException(isolate, Exception::RangeError(uni::NewLatin1String(isolate, "stackSize is out of range")));
+				return false;
+			}
+			return true;
 		}
 
 		/**
@@ -530,17 +860,32 @@ class Fiber {
 		 * callback; it doesn't create any new contexts until run() is called.
 		 */
 		static uni::FunctionType New(const uni::Arguments& args) {
-			if (args.Length() != 1) {
-				THROW(Exception::TypeError, "Fiber expects 1 argument");
+			Isolate* isolate = Isolate::GetCurrent();
+			if (args.Length() != 1 && args.Length() != 2) {
+				THROW(Exception::TypeError, "Fiber expects 1 or 2 arguments");
 			} else if (!args[0]->IsFunction()) {
 				THROW(Exception::TypeError, "Fiber expects a function");
-			} else if (!args.IsConstructCall()) {
-				Local<Value> argv[1] = { args[0] };
-				return uni::Return(uni::NewInstance(Isolate::GetCurrent(), uni::GetFunction(uni::Deref(Isolate::GetCurrent(), tmpl)), 1, argv), args);
+			}
+
+			// Stack size for this fiber, or 0 for the default
+			size_t stack_size;
+			if (!GetStackSizeOption(isolate, args.Length() == 2 ? args[1] : Local<Value>(uni::Undefined(isolate)), stack_size)) {
+				return uni::Return(Local<Value>(), args);
+			}
+
+			if (!args.IsConstructCall()) {
+				// Forward the already-validated options so the constructor can't throw
+				Local<Value> argv[2] = { args[0], uni::Undefined(isolate) };
+				if (stack_size) {
+					Local<Object> options = Object::New(isolate);
+					options->Set(isolate->GetCurrentContext(), uni::NewLatin1Symbol(isolate, "stackSize"), uni::NewNumber(isolate, stack_size * sizeof(void*))).FromJust();
+					argv[1] = options;
+				}
+				return uni::Return(uni::NewInstance(isolate, uni::GetFunction(uni::Deref(isolate, tmpl)), 2, argv), args);
 			}
 
 			Local<Function> fn = Local<Function>::Cast(args[0]);
-			new Fiber(args.This(), fn, uni::GetCurrentContext(Isolate::GetCurrent()));
+			new Fiber(args.This(), fn, uni::GetCurrentContext(isolate), stack_size);
 			return uni::Return(args.This(), args);
 		}
 
@@ -551,35 +896,66 @@ class Fiber {
 		static uni::FunctionType Run(const uni::Arguments& args) {
 			Fiber& that = Unwrap(args.Holder());
 
-			// There seems to be no better place to put this check..
-			DestroyOrphans();
+			// Orphans are normally unwound from the event loop, but code which never returns to it can
+			// still pile them up. Past a point each run() unwinds two, which is enough to catch up since
+			// a run() leaves at most one new orphan behind.
+			for (int ii = 0; ii < 2 && orphaned_fibers.size() > orphan_backlog_limit; ++ii) {
+				DestroyOrphan();
+			}
 
 			if (that.started && !that.yielding) {
 				THROW(Exception::Error, "This Fiber is already running");
+			} else if (that.queued) {
+				THROW(Exception::Error, "This Fiber is already waiting to run");
 			} else if (args.Length() > 1) {
 				THROW(Exception::TypeError, "run() excepts 1 or no arguments");
 			}
 
+			if (!that.started && Coroutine::get_stack_budget() && &that != admitting) {
+				// Out of stack budget. Either fail right away, or wait in line behind any other fibers
+				// which are already waiting.
+				if (budget_queue) {
+					if (!run_queue.empty() || !Coroutine::admit(that.stack_size, that.isolate)) {
+						QueuedRun* queued = new QueuedRun;
+						queued->fiber = &that;
+						queued->has_param = args.Length() != 0;
+						if (queued->has_param) {
+							uni::Reset(that.isolate, queued->param, args[0]);
+						}
+						run_queue.push_back(queued);
+						that.queued = true;
+						that.ClearWeak();
+						return uni::Return(uni::Undefined(that.isolate), args);
+					}
+				} else if (!Coroutine::admit(that.stack_size, that.isolate)) {
+					Local<Object> err = Local<Object>::Cast(Exception::Error(uni::NewLatin1String(that.isolate, "Fiber stack budget exceeded")));
+					err->Set(that.isolate->GetCurrentContext(), uni::NewLatin1Symbol(that.isolate, "code"), uni::NewLatin1String(that.isolate, "ERR_FIBER_STACK_BUDGET")).FromJust();
+					return uni::Return(uni::ThrowException(that.isolate, err), args);
+				}
+			}
+
 			if (!that.started) {
-				// Create a new context with entry point `Fiber::RunFiber()`.
-				void** data = new void*[2];
-				data[0] = (void*)&args;
-				data[1] = &that;
-				that.this_fiber = Coroutine::create_fiber((void (*)(void*))RunFiber, data);
+				// Create a new context with entry point `Fiber::RunFiber()`. The argument to `run()`, if
+				// any, is handed to the callback through `yielded` just like a resume.
+				that.this_fiber = Coroutine::create_fiber((void (*)(void*))RunFiber, &that, that.stack_size);
 				if (!that.this_fiber) {
-					delete[] data;
 					THROW(Exception::RangeError, "Out of memory");
 				}
+				ReportStack(that.isolate, that.this_fiber->size());
 				that.started = true;
+				++fibers_started;
+				that.yielded = args.Length() ? args[0] : Local<Value>();
+				starting_cb = that.GetCallback();
+				starting_context = that.GetContext();
 			} else {
 				// If the fiber is currently running put the first parameter to `run()` on `yielded`, then
 				// the pending call to `yield()` will return that value. `yielded` in this case is just a
-				// misnomer, we're just reusing the same handle.
+				// misnomer, we're just reusing the same slot.
 				that.yielded_exception = false;
 				if (args.Length()) {
-					uni::Reset(that.isolate, that.yielded, args[0]);
+					that.yielded = args[0];
 				} else {
-					uni::Reset<Value>(that.isolate, that.yielded, uni::Undefined(that.isolate));
+					that.yielded = uni::Undefined(that.isolate);
 				}
 			}
 			that.SwapContext();
@@ -595,9 +971,9 @@ class Fiber {
 			if (!that.yielding) {
 				THROW(Exception::Error, "This Fiber is not yielding");
 			} else if (args.Length() == 0) {
-				uni::Reset<Value>(that.isolate, that.yielded, uni::Undefined(that.isolate));
+				that.yielded = uni::Undefined(that.isolate);
 			} else if (args.Length() == 1) {
-				uni::Reset(that.isolate, that.yielded, args[0]);
+				that.yielded = args[0];
 			} else {
 				THROW(Exception::TypeError, "throwInto() expects 1 or no arguments");
 			}
@@ -624,10 +1000,12 @@ class Fiber {
 			that.resetting = true;
 			that.UnwindStack();
 			that.resetting = false;
-			that.MakeWeak();
 
-			Local<Value> val = uni::Deref(that.isolate, that.yielded);
-			uni::Dispose(that.isolate, that.yielded);
+			if (that.returned.IsEmpty()) {
+				return uni::Return(uni::Undefined(that.isolate), args);
+			}
+			Local<Value> val = uni::Deref(that.isolate, that.returned);
+			uni::Dispose(that.isolate, that.returned);
 			if (that.yielded_exception) {
 				return uni::Return(uni::ThrowException(that.isolate, val), args);
 			} else {
@@ -638,7 +1016,7 @@ class Fiber {
 		/**
 		 * Turns the fiber into a zombie and unwinds its whole stack.
 		 *
-		 * After calling this function you must either destroy this fiber or call MakeWeak() or it will
+		 * If this fiber is an orphan you must either destroy it or call MakeWeak() afterwards or it will
 		 * be leaked.
 		 */
 		void UnwindStack() {
@@ -647,25 +1025,48 @@ class Fiber {
 			assert(yielding);
 			zombie = true;
 
-			// Setup an exception which will be thrown and rethrown from Fiber::Yield()
-			Local<Value> zombie_exception = Exception::Error(uni::NewLatin1String(isolate, "This Fiber is a zombie"));
-			uni::Reset(isolate, this->zombie_exception, zombie_exception);
-			uni::Reset(isolate, yielded, zombie_exception);
+			// Swap context back to Fiber::Yield() which will throw the shared zombie exception to unwind
+			// the stack. Futher calls to yield from this fiber will rethrow it. If it makes it all the
+			// way out RunFiber() leaves `returned` empty, which reads as undefined.
+			yielded = uni::Deref(isolate, zombie_exception);
 			yielded_exception = true;
-
-			// Swap context back to Fiber::Yield() which will throw an exception to unwind the stack.
-			// Futher calls to yield from this fiber will rethrow the same exception.
 			SwapContext();
 			assert(!started);
 			zombie = false;
+		}
+
+		/**
+		 * Counts a started fiber's stack toward v8's external memory. Until the fiber finishes its
+		 * stack can only be reclaimed by collecting it, and without this a few kb of unreachable Fiber
+		 * objects can pin gigabytes of stacks without ever prompting a collection.
+		 *
+		 * Only new highs are reported, and the figure comes back down after full collections. v8
+		 * lowers its external memory limit on every decrease, so reporting each finished fiber right
+		 * away would force a full collection after every 64mb or so of fiber churn.
+		 */
+		static void ReportStack(Isolate* isolate, size_t bytes) {
+			stack_bytes_live += bytes;
+			if (stack_bytes_live > stack_bytes_reported) {
+				uni::AdjustAmountOfExternalAllocatedMemory(isolate, stack_bytes_live - stack_bytes_reported);
+				stack_bytes_reported = stack_bytes_live;
+			}
+		}
 
-			// Make sure this is the exception we threw
-			if (yielded_exception && yielded == zombie_exception) {
-				yielded_exception = false;
-				uni::Dispose(isolate, yielded);
-				uni::Reset<Value>(isolate, yielded, uni::Undefined(isolate));
+		/**
+		 * Called right before and right after handing control to another fiber. Both are a single
+		 * untaken branch unless `Fiber.switchTiming` is on.
+		 */
+		static void SwitchOut() {
+			if (switch_timing) {
+				switch_began = uv_hrtime();
+			}
+		}
+
+		static void SwitchIn() {
+			if (switch_began) {
+				switch_latency.record(uv_hrtime() - switch_began);
+				switch_began = 0;
 			}
-			uni::Dispose(isolate, this->zombie_exception);
 		}
 
 		/**
@@ -680,11 +1081,30 @@ class Fiber {
 
 			// This will jump into either `RunFiber()` or `Yield()`, depending on if the fiber was
 			// already running.
+			//
+			// The Unlocker / Locker pair looks like overhead since every fiber runs on the same OS
+			// thread, but v8 treats each fiber as its own thread. Releasing the lock is what makes v8
+			// archive this stack's thread state (handler chain, C entry frame, try/catch chain, stack
+			// guard) and restore the other one's. The isolate's entry stack is shared by all threads so
+			// we also have to exit the isolate before another fiber enters it. None of that is
+			// reachable through the public API, so the lock can't simply be handed over.
+			SwitchOut();
 			{
 				Unlocker unlocker(isolate);
 				uni::ReverseIsolateScope isolate_scope(isolate);
 				this_fiber->run();
 			}
+			SwitchIn();
+
+			if (!started) {
+				if (Coroutine::get_stack_tracking()) {
+					stack_usage = Coroutine::finished_stack_usage();
+				}
+				// A finished fiber may have made room for one which is waiting
+				if (!run_queue.empty()) {
+					uv_idle_start(admit_idle, AdmitQueued);
+				}
+			}
 
 			// At this point the fiber either returned or called `yield()`.
 			current = last_fiber;
@@ -692,10 +1112,21 @@ class Fiber {
 
 		/**
 		 * Grabs and resets this fiber's yielded value.
+		 *
+		 * Values passed by `run()`, `yield()` and `throwInto()` are plain local handles. They belong to
+		 * a HandleScope on the sender's stack, which stays suspended (and visible to the GC) until we
+		 * switch back to it, so they're copied into the current scope here. Only a fiber that returns
+		 * or throws needs `returned`, since its own scope is gone by the time anyone reads it.
 		 */
 		Local<Value> ReturnYielded() {
-			Local<Value> val = uni::Deref(isolate, yielded);
-			uni::Dispose(isolate, yielded);
+			Local<Value> val;
+			if (returned.IsEmpty()) {
+				val = uni::Deref(isolate, yielded);
+				yielded.Clear();
+			} else {
+				val = uni::Deref(isolate, returned);
+				uni::Dispose(isolate, returned);
+			}
 			if (yielded_exception) {
 				return uni::ThrowException(isolate, val);
 			} else {
@@ -706,10 +1137,8 @@ class Fiber {
 		/**
 		 * This is the entry point for a new fiber, from `run()`.
 		 */
-		static void RunFiber(void** data) {
-			const uni::Arguments* args = (const uni::Arguments*)data[0];
-			Fiber& that = *(Fiber*)data[1];
-			delete[] data;
+		static void RunFiber(Fiber* data) {
+			Fiber& that = *data;
 
 			// New C scope so that the stack-allocated objects will be destroyed before calling
 			// Coroutine::finish, because that function may not return, in which case the destructors in
@@ -718,50 +1147,57 @@ class Fiber {
 				Locker locker(that.isolate);
 				Isolate::Scope isolate_scope(that.isolate);
 				uni::HandleScope scope(that.isolate);
+				SwitchIn();
 
 				// Set the stack guard for this "thread"; allow 6k of padding past the JS limit for
 				// native v8 code to run
 				uni::SetStackGuard(that.isolate, reinterpret_cast<char*>(that.this_fiber->bottom()) + 1024 * 6);
 
 				uni::TryCatch try_catch(that.isolate);
-				that.ClearWeak();
-				Local<Context> v8_context = uni::Deref(that.isolate, that.v8_context);
+				Local<Function> cb = uni::Deref(that.isolate, starting_cb);
+				Local<Context> v8_context = uni::Deref(that.isolate, starting_context);
+				starting_cb.Clear();
+				starting_context.Clear();
 				v8_context->Enter();
 
 				uni::fixStackLimit(that.isolate, v8_context);
 
 				Local<Value> yielded;
-				if (args->Length()) {
-					Local<Value> argv[1] = { (*args)[0] };
-					yielded = uni::Call(uni::Deref(that.isolate, that.cb), v8_context->Global(), 1, argv);
+				if (!that.yielded.IsEmpty()) {
+					Local<Value> argv[1] = { uni::Deref(that.isolate, that.yielded) };
+					that.yielded.Clear();
+					yielded = uni::Call(cb, v8_context->Global(), 1, argv);
 				} else {
-					yielded = uni::Call(uni::Deref(that.isolate, that.cb), v8_context->Global(), 0, NULL);
+					yielded = uni::Call(cb, v8_context->Global(), 0, NULL);
 				}
 
 				if (try_catch.HasCaught()) {
-					uni::Reset(that.isolate, that.yielded, try_catch.Exception());
-					that.yielded_exception = true;
-					if (that.zombie && !that.resetting && !uni::Deref(that.isolate, that.yielded)->StrictEquals(uni::Deref(that.isolate, that.zombie_exception))) {
-						// Throwing an exception from a garbage sweep
-						uni::Reset(that.isolate, fatal_stack, uni::GetStackTrace(&try_catch, v8_context));
+					Local<Value> exception = try_catch.Exception();
+					if (that.zombie && exception == uni::Deref(that.isolate, zombie_exception)) {
+						// Unwound cleanly
+						that.yielded_exception = false;
+					} else {
+						uni::Reset(that.isolate, that.returned, exception);
+						that.yielded_exception = true;
+						if (that.zombie && !that.resetting) {
+							// Throwing an exception from a garbage sweep
+							uni::Reset(that.isolate, fatal_stack, uni::GetStackTrace(&try_catch, v8_context));
+						}
 					}
 				} else {
-					uni::Reset(that.isolate, that.yielded, yielded);
+					uni::Reset(that.isolate, that.returned, yielded);
 					that.yielded_exception = false;
 				}
 
-				// Don't make weak until after notifying the garbage collector. Otherwise it may try and
-				// free this very fiber!
-				if (!that.zombie) {
-					that.MakeWeak();
-				}
-
 				// Now safe to leave the context, this stack is done with JS.
 				v8_context->Exit();
 			}
 
 			// The function returned (instead of yielding).
 			that.started = false;
+			--fibers_started;
+			stack_bytes_live -= that.this_fiber->size();
+			SwitchOut();
 			that.this_fiber->finish(*that.entry_fiber, that.isolate);
 		}
 
@@ -778,34 +1214,31 @@ class Fiber {
 			Fiber& that = *current;
 
 			if (that.zombie) {
-				return uni::Return(uni::ThrowException(that.isolate, uni::Deref(that.isolate, that.zombie_exception)), args);
+				return uni::Return(uni::ThrowException(that.isolate, uni::Deref(that.isolate, zombie_exception)), args);
 			} else if (args.Length() == 0) {
-				uni::Reset<Value>(that.isolate, that.yielded, Undefined(that.isolate));
+				that.yielded = uni::Undefined(that.isolate);
 			} else if (args.Length() == 1) {
-				uni::Reset(that.isolate, that.yielded, args[0]);
+				that.yielded = args[0];
 			} else {
 				THROW(Exception::TypeError, "yield() expects 1 or no arguments");
 			}
 			that.yielded_exception = false;
 
-			// While not running this can be garbage collected if no one has a handle.
-			that.MakeWeak();
-
-			// Return control back to `Fiber::run()`. While control is outside this function we mark it as
-			// ok to garbage collect. If no one ever has a handle to resume the function it's harmful to
-			// keep the handle around.
+			// Return control back to `Fiber::run()`. The handle to this fiber is weak so if no one ever
+			// has a handle to resume the function it will be garbage collected and unwound.
+			SwitchOut();
 			{
 				Unlocker unlocker(that.isolate);
 				uni::ReverseIsolateScope isolate_scope(that.isolate);
 				that.yielding = true;
+				++fibers_yielding;
 				that.entry_fiber->run();
+				--fibers_yielding;
 				that.yielding = false;
 			}
+			SwitchIn();
 			// Now `run()` has been called again.
 
-			// Don't garbage collect anymore!
-			that.ClearWeak();
-
 			// Return the yielded value
 			return uni::Return(that.ReturnYielded(), args);
 		}
@@ -814,13 +1247,26 @@ class Fiber {
 		 * Getters for `started`, and `current`.
 		 */
 		static uni::FunctionType GetStarted(Local<String> property, const uni::GetterCallbackInfo& info) {
-			if (info.This().IsEmpty() || info.This()->InternalFieldCount() != 1) {
+			if (info.This().IsEmpty() || info.This()->InternalFieldCount() != field_count) {
 				return uni::Return(uni::Undefined(Isolate::GetCurrent()), info);
 			}
 			Fiber& that = Unwrap(info.This());
 			return uni::Return(uni::NewBoolean(that.isolate, that.started), info);
 		}
 
+		/**
+		 * Bytes of stack used by this fiber: the current depth if it's running, or the peak of its
+		 * last run. Undefined unless `Fiber.stackUsageTracking` is on.
+		 */
+		static uni::FunctionType GetStackUsage(Local<String> property, const uni::GetterCallbackInfo& info) {
+			if (info.This().IsEmpty() || info.This()->InternalFieldCount() != field_count || !Coroutine::get_stack_tracking()) {
+				return uni::Return(uni::Undefined(Isolate::GetCurrent()), info);
+			}
+			Fiber& that = Unwrap(info.This());
+			size_t bytes = that.started ? that.this_fiber->stack_usage() : that.stack_usage;
+			return uni::Return(uni::NewNumber(that.isolate, bytes), info);
+		}
+
 		static uni::FunctionType GetCurrent(Local<String> property, const uni::GetterCallbackInfo& info) {
 			if (current) {
 				return uni::Return(current->handle, info);
@@ -840,6 +1286,429 @@ class Fiber {
 			Coroutine::pool_size = uni::ToNumber(value)->Value();
 		}
 
+		/**
+		 * Limit in bytes on the stack held by fibers, and whether to queue fibers over the limit
+		 * instead of throwing
+		 */
+		static uni::FunctionType GetStackBudget(Local<String> property, const uni::GetterCallbackInfo& info) {
+			return uni::Return(uni::NewNumber(Isolate::GetCurrent(), Coroutine::get_stack_budget()), info);
+		}
+
+		static void SetStackBudget(Local<String> property, Local<Value> value, const uni::SetterCallbackInfo& info) {
+			double bytes = uni::ToNumber(value)->Value();
+			Coroutine::set_stack_budget(bytes > 0 ? (size_t)bytes : 0);
+			if (!run_queue.empty()) {
+				uv_idle_start(admit_idle, AdmitQueued);
+			}
+		}
+
+		static uni::FunctionType GetStackBudgetQueue(Local<String> property, const uni::GetterCallbackInfo& info) {
+			return uni::Return(uni::NewBoolean(Isolate::GetCurrent(), budget_queue), info);
+		}
+
+		static void SetStackBudgetQueue(Local<String> property, Local<Value> value, const uni::SetterCallbackInfo& info) {
+			budget_queue = uni::ToBoolean(Isolate::GetCurrent(), value);
+		}
+
+		static uni::FunctionType GetStackInUse(Local<String> property, const uni::GetterCallbackInfo& info) {
+			return uni::Return(uni::NewNumber(Isolate::GetCurrent(), Coroutine::stack_in_use()), info);
+		}
+
+		/**
+		 * Returns runtime counters in a Float64Array, indexed like `Fiber.statsFields`. The same
+		 * array is refreshed and returned every time, so reading it doesn't allocate.
+		 */
+		static uni::FunctionType Stats(const uni::Arguments& args) {
+			Isolate* isolate = Isolate::GetCurrent();
+			double* stats = stats_buffer;
+			*stats++ = fibers_live;
+			*stats++ = fibers_started;
+			*stats++ = fibers_yielding;
+			*stats++ = Coroutine::pool_hits();
+			*stats++ = Coroutine::pool_misses();
+			*stats++ = Coroutine::pool_count();
+			*stats++ = Coroutine::coroutines_created();
+			*stats++ = Coroutine::coroutines_destroyed();
+			*stats++ = Coroutine::switches();
+			*stats++ = orphans_queued;
+			*stats++ = orphans_unwound;
+			*stats++ = orphaned_fibers.size();
+			*stats++ = Coroutine::stack_reserved();
+			*stats++ = Coroutine::stack_committed();
+			assert(stats == stats_buffer + stats_count);
+			return uni::Return(uni::Deref(isolate, stats_array), args);
+		}
+
+		/**
+		 * Turns stack usage tracking on or off
+		 */
+		static uni::FunctionType GetStackUsageTracking(Local<String> property, const uni::GetterCallbackInfo& info) {
+			return uni::Return(uni::NewBoolean(Isolate::GetCurrent(), Coroutine::get_stack_tracking()), info);
+		}
+
+		static void SetStackUsageTracking(Local<String> property, Local<Value> value, const uni::SetterCallbackInfo& info) {
+			Isolate* isolate = Isolate::GetCurrent();
+			Coroutine::set_stack_tracking(uni::ToBoolean(isolate, value), isolate);
+		}
+
+		/**
+		 * Turns context switch timing on or off. Turning it on starts a fresh histogram.
+		 */
+		static uni::FunctionType GetSwitchTiming(Local<String> property, const uni::GetterCallbackInfo& info) {
+			return uni::Return(uni::NewBoolean(Isolate::GetCurrent(), switch_timing), info);
+		}
+
+		static void SetSwitchTiming(Local<String> property, Local<Value> value, const uni::SetterCallbackInfo& info) {
+			bool timing = uni::ToBoolean(Isolate::GetCurrent(), value);
+			if (timing && !switch_timing) {
+				switch_latency.reset();
+			}
+			switch_timing = timing;
+			switch_began = 0;
+		}
+
+		/**
+		 * Summarizes recorded context switch times, in nanoseconds
+		 */
+		static uni::FunctionType SwitchLatency(const uni::Arguments& args) {
+			Isolate* isolate = Isolate::GetCurrent();
+			Local<Context> context = isolate->GetCurrentContext();
+			Local<Object> result = Object::New(isolate);
+			const LatencyHistogram& hist = switch_latency;
+			result->Set(context, uni::NewLatin1Symbol(isolate, "count"), uni::NewNumber(isolate, hist.count())).FromJust();
+			result->Set(context, uni::NewLatin1Symbol(isolate, "min"), uni::NewNumber(isolate, hist.min())).FromJust();
+			result->Set(context, uni::NewLatin1Symbol(isolate, "mean"), uni::NewNumber(isolate, hist.mean())).FromJust();
+			result->Set(context, uni::NewLatin1Symbol(isolate, "p50"), uni::NewNumber(isolate, hist.percentile(50))).FromJust();
+			result->Set(context, uni::NewLatin1Symbol(isolate, "p90"), uni::NewNumber(isolate, hist.percentile(90))).FromJust();
+			result->Set(context, uni::NewLatin1Symbol(isolate, "p99"), uni::NewNumber(isolate, hist.percentile(99))).FromJust();
+			result->Set(context, uni::NewLatin1Symbol(isolate, "p999"), uni::NewNumber(isolate, hist.percentile(99.9))).FromJust();
+			result->Set(context, uni::NewLatin1Symbol(isolate, "max"), uni::NewNumber(isolate, hist.max())).FromJust();
+			return uni::Return(result, args);
+		}
+
+		/**
+		 * Returns the number of finished fibers by peak stack usage. Element `n` counts fibers which
+		 * used more than 4kb << (n - 1) and at most 4kb << n.
+		 */
+		static uni::FunctionType StackUsageHistogram(const uni::Arguments& args) {
+			Isolate* isolate = Isolate::GetCurrent();
+			Local<Context> context = isolate->GetCurrentContext();
+			const size_t* counts = Coroutine::stack_usage_histogram();
+			Local<Array> histogram = Array::New(isolate, Coroutine::stack_usage_buckets);
+			for (size_t ii = 0; ii < Coroutine::stack_usage_buckets; ++ii) {
+				histogram->Set(context, ii, uni::NewNumber(isolate, counts[ii])).FromJust();
+			}
+			return uni::Return(histogram, args);
+		}
+
+		/**
+		 * Most fibers the pool will grow to when demand is higher than `poolSize`
+		 */
+		static uni::FunctionType GetPoolMaxSize(Local<String> property, const uni::GetterCallbackInfo& info) {
+			return uni::Return(uni::NewNumber(Isolate::GetCurrent(), Coroutine::pool_max_size), info);
+		}
+
+		static void SetPoolMaxSize(Local<String> property, Local<Value> value, const uni::SetterCallbackInfo& info) {
+			Coroutine::pool_max_size = uni::ToNumber(value)->Value();
+		}
+
+		/**
+		 * How often, in milliseconds, the pool shrinks back toward recent demand
+		 */
+		static uni::FunctionType GetPoolIdleTime(Local<String> property, const uni::GetterCallbackInfo& info) {
+			return uni::Return(uni::NewNumber(Isolate::GetCurrent(), pool_idle_time), info);
+		}
+
+		static void SetPoolIdleTime(Local<String> property, Local<Value> value, const uni::SetterCallbackInfo& info) {
+			double ms = uni::ToNumber(value)->Value();
+			pool_idle_time = ms >= 1 ? (uint64_t)ms : 1;
+			uv_timer_start(pool_timer, DecayPool, pool_idle_time, pool_idle_time);
+		}
+
+		/**
+		 * Time in milliseconds spent unwinding orphaned fibers per event loop iteration. 0 unwinds
+		 * the whole backlog at once.
+		 */
+		static uni::FunctionType GetOrphanBudget(Local<String> property, const uni::GetterCallbackInfo& info) {
+			return uni::Return(uni::NewNumber(Isolate::GetCurrent(), orphan_budget / 1e6), info);
+		}
+
+		static void SetOrphanBudget(Local<String> property, Local<Value> value, const uni::SetterCallbackInfo& info) {
+			double ms = uni::ToNumber(value)->Value();
+			orphan_budget = ms > 0 ? (uint64_t)(ms * 1e6) : 0;
+		}
+
+		/**
+		 * Unwinds orphaned fibers and gives back the memory held by the fiber pool. Returns the
+		 * number of pooled fibers released.
+		 */
+		static size_t Trim(Isolate* isolate) {
+			DestroyOrphans();
+			return Coroutine::trim(isolate);
+		}
+
+		static uni::FunctionType Trim(const uni::Arguments& args) {
+			Isolate* isolate = Isolate::GetCurrent();
+			return uni::Return(uni::NewNumber(isolate, Trim(isolate)), args);
+		}
+
+		/**
+		 * v8 is running out of heap. Fiber stacks aren't part of the heap, but orphaned fibers hold on
+		 * to whatever is on their stacks until they're unwound. That runs Javascript so it has to wait
+		 * for the event loop, and v8 gets a little headroom to make it there. TrimAsync() puts the
+		 * limit back. If it's hit again before then, or there's nothing to trim, the limit stands.
+		 */
+		static size_t NearHeapLimit(void* data, size_t current_heap_limit, size_t initial_heap_limit) {
+			if (heap_limit || (orphaned_fibers.empty() && Coroutine::pool_count() == 0)) {
+				return current_heap_limit;
+			}
+			heap_limit = current_heap_limit;
+			trim_pending = true;
+			size_t bump = current_heap_limit / 2;
+			return current_heap_limit + (bump < heap_limit_bump ? bump : heap_limit_bump);
+		}
+
+#if V8_AT_LEAST(6, 8)
+		/**
+		 * Stands in for the native side of a Fiber in heap snapshots. The JS object retains it, so
+		 * the stack counts toward the retained size of the fiber and of whatever keeps it alive. It
+		 * isn't merged into the JS object since older versions of v8 drop the size when merging.
+		 */
+		class SnapshotNode : public EmbedderGraph::Node {
+			private:
+				Fiber& fiber;
+
+			public:
+				explicit SnapshotNode(Fiber& fiber) : fiber(fiber) {}
+
+				virtual const char* Name() {
+					return fiber.started ? "Fiber (started)" : "Fiber (not started)";
+				}
+
+				virtual size_t SizeInBytes() {
+					return sizeof(Fiber) + (fiber.started ? fiber.this_fiber->size() : 0);
+				}
+		};
+
+		/**
+		 * Adds every Fiber to a heap snapshot, with edges to the values it keeps alive
+		 */
+		static void BuildEmbedderGraph(Isolate* isolate, EmbedderGraph* graph, void* data) {
+			uni::HandleScope scope(isolate);
+			for (Fiber* fiber = live_fibers; fiber != NULL; fiber = fiber->next_live) {
+				EmbedderGraph::Node* node = graph->AddNode(std::unique_ptr<EmbedderGraph::Node>(new SnapshotNode(*fiber)));
+				graph->AddEdge(graph->V8Node(uni::Deref(isolate, fiber->handle)), node);
+				if (!fiber->yielded.IsEmpty()) {
+					graph->AddEdge(node, graph->V8Node(fiber->yielded));
+				}
+				if (!fiber->returned.IsEmpty()) {
+					graph->AddEdge(node, graph->V8Node(uni::Deref(isolate, fiber->returned)));
+				}
+			}
+		}
+#endif
+
+		static void AfterGC(Isolate* isolate, GCType type, GCCallbackFlags flags) {
+			if (type == kGCTypeMarkSweepCompact && stack_bytes_reported > stack_bytes_live) {
+				uni::AdjustAmountOfExternalAllocatedMemory(isolate, stack_bytes_live - stack_bytes_reported);
+				stack_bytes_reported = stack_bytes_live;
+			}
+			if (type == kGCTypeMarkSweepCompact && trim_pending) {
+				// The collection v8 makes near its heap limit. Unwinding orphans runs Javascript, which
+				// can't happen here.
+				trim_pending = false;
+				uv_async_send(trim_async);
+			}
+		}
+
+		static void TrimAsync(uv_async_t* handle) {
+			Isolate* isolate = static_cast<Isolate*>(handle->data);
+			uni::HandleScope scope(isolate);
+			Trim(isolate);
+			if (heap_limit) {
+				// Collect what the unwound fibers let go of before going back to the old limit. v8
+				// won't set it below what's still in use, so this can't push it over.
+				isolate->LowMemoryNotification();
+				uni::RemoveNearHeapLimitCallback(isolate, NearHeapLimit, heap_limit);
+				uni::AddNearHeapLimitCallback(isolate, NearHeapLimit);
+				heap_limit = 0;
+			}
+		}
+
+		/**
+		 * Starts as many waiting fibers as the stack budget allows, in the order they called run().
+		 * Exceptions they throw are uncaught exceptions, like any other callback from the event loop.
+		 */
+		static void AdmitQueued(uv_idle_t* handle) {
+			Isolate* isolate = static_cast<Isolate*>(handle->data);
+			uni::HandleScope scope(isolate);
+			uv_idle_stop(handle);
+			while (!run_queue.empty() && Coroutine::admit(run_queue.front()->fiber->stack_size, isolate)) {
+				QueuedRun* next = run_queue.front();
+				run_queue.pop_front();
+				Fiber& that = *next->fiber;
+				Local<Value> argv[1];
+				if (next->has_param) {
+					argv[0] = uni::Deref(isolate, next->param);
+					uni::Dispose(isolate, next->param);
+				}
+				delete next;
+				Local<Object> fiber_handle = uni::Deref(isolate, that.handle);
+				that.queued = false;
+				that.MakeWeak();
+				admitting = &that;
+				uni::MakeCallback(isolate, fiber_handle, "run", argv[0].IsEmpty() ? 0 : 1, argv);
+				admitting = NULL;
+			}
+		}
+
+		/**
+		 * Event loop of the calling thread's isolate. For a worker that's its own loop, not the
+		 * default one.
+		 */
+		static uv_loop_t* EventLoop(Isolate* isolate) {
+#if NODE_VERSION_AT_LEAST(9, 3, 0)
+			return node::GetCurrentEventLoop(isolate);
+#else
+			return uv_default_loop();
+#endif
+		}
+
+#if NODE_VERSION_AT_LEAST(10, 5, 0)
+		/**
+		 * Our handles are allocated on their own rather than being thread locals, since a worker's
+		 * loop may finish closing them after its thread is gone.
+		 */
+		template <class T>
+		static void FreeHandle(uv_handle_t* handle) {
+			delete reinterpret_cast<T*>(handle);
+		}
+
+		/**
+		 * Runs when a worker stops. Its event loop is closed right after, which fails if any of our
+		 * handles are still open. Fibers it leaves suspended are unwound like reset() would, and
+		 * anything they throw is dropped. Then every fiber is freed along with its stack.
+		 */
+		static void Cleanup(void* data) {
+			Isolate* isolate = static_cast<Isolate*>(data);
+			uni::HandleScope scope(isolate);
+			// The heap callbacks signal handles which are about to go away
+			isolate->RemoveGCEpilogueCallback(AfterGC);
+			uni::RemoveNearHeapLimitCallback(isolate, NearHeapLimit, heap_limit);
+			heap_limit = 0;
+			trim_pending = false;
+#if V8_AT_LEAST(6, 8)
+			isolate->GetHeapProfiler()->RemoveBuildEmbedderGraphCallback(BuildEmbedderGraph, NULL);
+#endif
+			uv_close(reinterpret_cast<uv_handle_t*>(pool_timer), FreeHandle<uv_timer_t>);
+			uv_close(reinterpret_cast<uv_handle_t*>(trim_async), FreeHandle<uv_async_t>);
+			uv_close(reinterpret_cast<uv_handle_t*>(admit_idle), FreeHandle<uv_idle_t>);
+			uv_close(reinterpret_cast<uv_handle_t*>(orphan_idle), FreeHandle<uv_idle_t>);
+
+			while (!run_queue.empty()) {
+				QueuedRun* queued = run_queue.front();
+				run_queue.pop_front();
+				if (queued->has_param) {
+					uni::Dispose(isolate, queued->param);
+				}
+				queued->fiber->queued = false;
+				delete queued;
+			}
+			orphaned_fibers.clear();
+
+			// Collections while unwinding could otherwise queue more orphans or free fibers out from
+			// under this loop, so every fiber is held on to until the end.
+			for (Fiber* fiber = live_fibers; fiber; fiber = fiber->next_live) {
+				fiber->ClearWeak();
+			}
+
+			// Suspended fibers still hold a Locker and handle scopes on their stacks, which V8 only
+			// gives back when they unwind. Whatever they throw on the way out has nowhere to go.
+			for (Fiber* fiber = live_fibers; fiber; fiber = fiber->next_live) {
+				if (fiber->started && fiber->yielding && !fiber->zombie) {
+					Local<Context> v8_context = fiber->GetContext();
+					v8_context->Enter();
+					fiber->resetting = true;
+					fiber->UnwindStack();
+					fiber->resetting = false;
+					v8_context->Exit();
+					uni::Dispose(isolate, fiber->returned);
+				}
+			}
+			uni::Dispose(isolate, fatal_stack);
+			while (live_fibers) {
+				Fiber* fiber = live_fibers;
+				if (fiber->started) {
+					fiber->this_fiber->discard();
+					fiber->started = false;
+				}
+				uni::Dispose(isolate, fiber->returned);
+				delete fiber;
+			}
+			Coroutine::trim(isolate);
+			delete global_locker;
+			global_locker = NULL;
+		}
+#endif
+
+		/**
+		 * Timer callback which lets the pool shrink after a burst. The timer is unref'd so it never
+		 * keeps the process alive.
+		 */
+		static void DecayPool(uv_timer_t* timer) {
+			Coroutine::decay_pool(static_cast<Isolate*>(timer->data));
+		}
+
+		/**
+		 * Fill the fiber pool ahead of time so that run() doesn't have to allocate stacks later.
+		 * Returns the number of fibers added.
+		 */
+		static uni::FunctionType Prewarm(const uni::Arguments& args) {
+			Isolate* isolate = Isolate::GetCurrent();
+			if (args.Length() < 1 || !args[0]->IsNumber()) {
+				THROW(Exception::TypeError, "prewarm() expects a number");
+			}
+			size_t stack_size;
+			if (!GetStackSizeOption(isolate, args.Length() >= 2 ? args[1] : Local<Value>(uni::Undefined(isolate)), stack_size)) {
+				return uni::Return(Local<Value>(), args);
+			}
+			double count = uni::ToNumber(args[0])->Value();
+			size_t added = count > 0 ? Coroutine::prewarm((size_t)count, stack_size) : 0;
+			return uni::Return(uni::NewNumber(isolate, added), args);
+		}
+
+		/**
+		 * Number of default-sized stacks a helper thread keeps ready for new fibers
+		 */
+		static uni::FunctionType GetStackReserve(Local<String> property, const uni::GetterCallbackInfo& info) {
+			return uni::Return(uni::NewNumber(Isolate::GetCurrent(), Coroutine::get_stack_reserve()), info);
+		}
+
+		static void SetStackReserve(Local<String> property, Local<Value> value, const uni::SetterCallbackInfo& info) {
+			Isolate* isolate = Isolate::GetCurrent();
+			double count = uni::ToNumber(value)->Value();
+			if (!Coroutine::set_stack_reserve(count > 0 ? (size_t)count : 0)) {
+				uni::ThrowException(isolate, Exception::Error(uni::NewLatin1String(isolate, "Couldn't start the stack reserve thread")));
+			}
+		}
+
+		/**
+		 * Default stack size for new fibers, in bytes. Can't be changed once fibers have been created.
+		 */
+		static uni::FunctionType GetDefaultStackSize(Local<String> property, const uni::GetterCallbackInfo& info) {
+			return uni::Return(uni::NewNumber(Isolate::GetCurrent(), Coroutine::get_stack_size() * sizeof(void*)), info);
+		}
+
+		static void SetDefaultStackSize(Local<String> property, Local<Value> value, const uni::SetterCallbackInfo& info) {
+			Isolate* isolate = Isolate::GetCurrent();
+			size_t stack_size = StackSizeFromBytes(value);
+			if (!stack_size) {
+				uni::ThrowException(isolate, Exception::RangeError(uni::NewLatin1String(isolate, "Invalid stack size")));
+			} else if (!Coroutine::set_stack_size(stack_size)) {
+				uni::ThrowException(isolate, Exception::Error(uni::NewLatin1String(isolate, "The default stack size can't be changed once fibers have been created")));
+			}
+		}
+
 		/**
 		 * Return number of fibers that have been created
 		 */
@@ -847,6 +1716,32 @@ class Fiber {
 			return uni::Return(uni::NewNumber(Isolate::GetCurrent(), Coroutine::coroutines_created()), info);
 		}
 
+		/**
+		 * Address space reserved for fiber stacks, and the part of it fibers can actually use
+		 */
+		static uni::FunctionType GetStackReserved(Local<String> property, const uni::GetterCallbackInfo& info) {
+			return uni::Return(uni::NewNumber(Isolate::GetCurrent(), Coroutine::stack_reserved()), info);
+		}
+
+		static uni::FunctionType GetStackCommitted(Local<String> property, const uni::GetterCallbackInfo& info) {
+			return uni::Return(uni::NewNumber(Isolate::GetCurrent(), Coroutine::stack_committed()), info);
+		}
+
+		static uni::FunctionType GetStackResident(Local<String> property, const uni::GetterCallbackInfo& info) {
+			return uni::Return(uni::NewNumber(Isolate::GetCurrent(), Coroutine::stack_resident()), info);
+		}
+
+		/**
+		 * Bytes at the top of each pooled fiber's stack which stay resident
+		 */
+		static uni::FunctionType GetStackWatermark(Local<String> property, const uni::GetterCallbackInfo& info) {
+			return uni::Return(uni::NewNumber(Isolate::GetCurrent(), Coroutine::stack_watermark), info);
+		}
+
+		static void SetStackWatermark(Local<String> property, Local<Value> value, const uni::SetterCallbackInfo& info) {
+			Coroutine::stack_watermark = uni::ToNumber(value)->Value();
+		}
+
 	public:
 		/**
 		 * Initialize the Fiber library.
@@ -861,6 +1756,47 @@ class Fiber {
 			Local<Context> context = isolate->GetCurrentContext();
 			global_locker = new Locker(isolate);
 			current = NULL;
+			uv_loop_t* loop = EventLoop(isolate);
+
+			pool_timer = new uv_timer_t;
+			uv_timer_init(loop, pool_timer);
+			pool_timer->data = isolate;
+			uv_timer_start(pool_timer, DecayPool, pool_idle_time, pool_idle_time);
+			uv_unref(reinterpret_cast<uv_handle_t*>(pool_timer));
+
+			// Memory pressure
+			trim_async = new uv_async_t;
+			uv_async_init(loop, trim_async, TrimAsync);
+			trim_async->data = isolate;
+			uv_unref(reinterpret_cast<uv_handle_t*>(trim_async));
+
+			// Stack budget
+			admit_idle = new uv_idle_t;
+			uv_idle_init(loop, admit_idle);
+			admit_idle->data = isolate;
+
+			// Orphan reclamation
+			orphan_idle = new uv_idle_t;
+			uv_idle_init(loop, orphan_idle);
+			orphan_idle->data = isolate;
+			uv_unref(reinterpret_cast<uv_handle_t*>(orphan_idle));
+#if NODE_VERSION_AT_LEAST(10, 5, 0)
+			if (loop != uv_default_loop()) {
+				node::AddEnvironmentCleanupHook(isolate, Cleanup, isolate);
+			}
+#endif
+			uni::AddNearHeapLimitCallback(isolate, NearHeapLimit);
+			isolate->AddGCEpilogueCallback(AfterGC);
+#if V8_AT_LEAST(6, 8)
+			// Older versions of v8 leave fiber stacks out of heap snapshots
+			isolate->GetHeapProfiler()->AddBuildEmbedderGraphCallback(BuildEmbedderGraph, NULL);
+#endif
+
+			// Unwinding a fiber throws this same object every time, instead of building a new Error and
+			// capturing a stack trace for each one. The trace it was created with would only mislead.
+			Local<Object> zombie = Exception::Error(uni::NewLatin1String(isolate, "This Fiber is a zombie")).As<Object>();
+			zombie->Set(context, uni::NewLatin1Symbol(isolate, "stack"), uni::NewLatin1String(isolate, "Error: This Fiber is a zombie")).FromJust();
+			uni::Reset<Value>(isolate, zombie_exception, zombie);
 
 			// Fiber constructor
 			Local<FunctionTemplate> tmpl = uni::NewFunctionTemplate(isolate, New);
@@ -870,7 +1806,7 @@ class Fiber {
 			// Guard which only allows these methods to be called on a fiber; prevents
 			// `fiber.run.call({})` from seg faulting.
 			Local<Signature> sig = uni::NewSignature(isolate, tmpl);
-			tmpl->InstanceTemplate()->SetInternalFieldCount(1);
+			tmpl->InstanceTemplate()->SetInternalFieldCount(field_count);
 
 			// Fiber.prototype
 			Local<ObjectTemplate> proto = tmpl->PrototypeTemplate();
@@ -881,6 +1817,7 @@ class Fiber {
 			proto->Set(uni::NewLatin1Symbol(isolate, "throwInto"),
 				uni::NewFunctionTemplate(isolate, ThrowInto, Local<Value>(), sig));
 			proto->SetAccessor(uni::NewLatin1Symbol(isolate, "started"), GetStarted);
+			proto->SetAccessor(uni::NewLatin1Symbol(isolate, "stackUsage"), GetStackUsage);
 
 			// Global yield() function
 			Local<Function> yield = uni::GetFunction(uni::NewFunctionTemplate(isolate, Yield_));
@@ -890,9 +1827,37 @@ class Fiber {
 			// Fiber properties
 			Local<Function> fn = uni::GetFunction(tmpl);
 			fn->Set(context, sym_yield, yield).FromJust();
+			fn->Set(context, uni::NewLatin1Symbol(isolate, "prewarm"), uni::GetFunction(uni::NewFunctionTemplate(isolate, Prewarm))).FromJust();
+			fn->Set(context, uni::NewLatin1Symbol(isolate, "trim"), uni::GetFunction(uni::NewFunctionTemplate(isolate, Trim))).FromJust();
+			fn->Set(context, uni::NewLatin1Symbol(isolate, "stackUsageHistogram"), uni::GetFunction(uni::NewFunctionTemplate(isolate, StackUsageHistogram))).FromJust();
+
+			// Fiber.stats() hands out the same array every time and writes straight into its memory,
+			// which v8 owns. `stats_array` keeps it alive as long as the isolate.
+			uni::Reset<Object>(isolate, stats_array, uni::NewFloat64Array(isolate, stats_count, &stats_buffer));
+			Local<Array> stats_names = Array::New(isolate, stats_count);
+			for (size_t ii = 0; ii < stats_count; ++ii) {
+				stats_names->Set(context, ii, uni::NewLatin1String(isolate, stats_fields[ii])).FromJust();
+			}
+			fn->Set(context, uni::NewLatin1Symbol(isolate, "statsFields"), stats_names).FromJust();
+			fn->Set(context, uni::NewLatin1Symbol(isolate, "stats"), uni::GetFunction(uni::NewFunctionTemplate(isolate, Stats))).FromJust();
+			fn->Set(context, uni::NewLatin1Symbol(isolate, "switchLatency"), uni::GetFunction(uni::NewFunctionTemplate(isolate, SwitchLatency))).FromJust();
 			uni::SetAccessor(isolate, fn, uni::NewLatin1Symbol(isolate, "current"), GetCurrent);
 			uni::SetAccessor(isolate, fn, uni::NewLatin1Symbol(isolate, "poolSize"), GetPoolSize, SetPoolSize);
+			uni::SetAccessor(isolate, fn, uni::NewLatin1Symbol(isolate, "poolMaxSize"), GetPoolMaxSize, SetPoolMaxSize);
+			uni::SetAccessor(isolate, fn, uni::NewLatin1Symbol(isolate, "poolIdleTime"), GetPoolIdleTime, SetPoolIdleTime);
+			uni::SetAccessor(isolate, fn, uni::NewLatin1Symbol(isolate, "orphanBudget"), GetOrphanBudget, SetOrphanBudget);
+			uni::SetAccessor(isolate, fn, uni::NewLatin1Symbol(isolate, "defaultStackSize"), GetDefaultStackSize, SetDefaultStackSize);
+			uni::SetAccessor(isolate, fn, uni::NewLatin1Symbol(isolate, "stackWatermark"), GetStackWatermark, SetStackWatermark);
+			uni::SetAccessor(isolate, fn, uni::NewLatin1Symbol(isolate, "stackReserve"), GetStackReserve, SetStackReserve);
+			uni::SetAccessor(isolate, fn, uni::NewLatin1Symbol(isolate, "stackBudget"), GetStackBudget, SetStackBudget);
+			uni::SetAccessor(isolate, fn, uni::NewLatin1Symbol(isolate, "stackBudgetQueue"), GetStackBudgetQueue, SetStackBudgetQueue);
+			uni::SetAccessor(isolate, fn, uni::NewLatin1Symbol(isolate, "stackInUse"), GetStackInUse);
+			uni::SetAccessor(isolate, fn, uni::NewLatin1Symbol(isolate, "stackUsageTracking"), GetStackUsageTracking, SetStackUsageTracking);
+			uni::SetAccessor(isolate, fn, uni::NewLatin1Symbol(isolate, "switchTiming"), GetSwitchTiming, SetSwitchTiming);
 			uni::SetAccessor(isolate, fn, uni::NewLatin1Symbol(isolate, "fibersCreated"), GetFibersCreated);
+			uni::SetAccessor(isolate, fn, uni::NewLatin1Symbol(isolate, "stackReserved"), GetStackReserved);
+			uni::SetAccessor(isolate, fn, uni::NewLatin1Symbol(isolate, "stackCommitted"), GetStackCommitted);
+			uni::SetAccessor(isolate, fn, uni::NewLatin1Symbol(isolate, "stackResident"), GetStackResident);
 
 			// Global Fiber
 			target->Set(context, uni::NewLatin1Symbol(isolate, "Fiber"), fn).FromJust();
@@ -900,13 +1865,48 @@ class Fiber {
 		}
 };
 
-Persistent<FunctionTemplate> Fiber::tmpl;
-Persistent<Function> Fiber::fiber_object;
-Locker* Fiber::global_locker;
-Fiber* Fiber::current = NULL;
-vector<Fiber*> Fiber::orphaned_fibers;
-Persistent<Value> Fiber::fatal_stack;
-bool did_init = false;
+ISOLATE_LOCAL Persistent<FunctionTemplate> Fiber::tmpl;
+ISOLATE_LOCAL Persistent<Function> Fiber::fiber_object;
+ISOLATE_LOCAL Locker* Fiber::global_locker;
+ISOLATE_LOCAL Fiber* Fiber::current = NULL;
+ISOLATE_LOCAL Fiber* Fiber::live_fibers = NULL;
+ISOLATE_LOCAL deque<Fiber*> Fiber::orphaned_fibers;
+ISOLATE_LOCAL uv_idle_t* Fiber::orphan_idle = NULL;
+ISOLATE_LOCAL uint64_t Fiber::orphan_budget = 1000000;
+ISOLATE_LOCAL Persistent<Value> Fiber::fatal_stack;
+ISOLATE_LOCAL Persistent<Value> Fiber::zombie_exception;
+ISOLATE_LOCAL uv_timer_t* Fiber::pool_timer = NULL;
+ISOLATE_LOCAL uv_async_t* Fiber::trim_async = NULL;
+ISOLATE_LOCAL size_t Fiber::heap_limit = 0;
+ISOLATE_LOCAL bool Fiber::trim_pending = false;
+ISOLATE_LOCAL size_t Fiber::fibers_live = 0;
+ISOLATE_LOCAL size_t Fiber::fibers_started = 0;
+ISOLATE_LOCAL size_t Fiber::fibers_yielding = 0;
+ISOLATE_LOCAL size_t Fiber::orphans_queued = 0;
+ISOLATE_LOCAL size_t Fiber::orphans_unwound = 0;
+const char* const Fiber::stats_fields[Fiber::stats_count] = {
+	"fibersLive", "fibersStarted", "fibersYielding", "poolHits", "poolMisses", "poolSize",
+	"coroutinesCreated", "coroutinesDestroyed", "switches", "orphansQueued", "orphansUnwound",
+	"orphansPending", "stackReserved", "stackCommitted"
+};
+ISOLATE_LOCAL double* Fiber::stats_buffer = NULL;
+ISOLATE_LOCAL Persistent<Object> Fiber::stats_array;
+ISOLATE_LOCAL int64_t Fiber::stack_bytes_live = 0;
+ISOLATE_LOCAL int64_t Fiber::stack_bytes_reported = 0;
+ISOLATE_LOCAL bool Fiber::switch_timing = false;
+ISOLATE_LOCAL uint64_t Fiber::switch_began = 0;
+ISOLATE_LOCAL LatencyHistogram Fiber::switch_latency;
+ISOLATE_LOCAL bool Fiber::budget_queue = false;
+ISOLATE_LOCAL deque<Fiber::QueuedRun*> Fiber::run_queue;
+ISOLATE_LOCAL Fiber* Fiber::admitting = NULL;
+ISOLATE_LOCAL uv_idle_t* Fiber::admit_idle = NULL;
+ISOLATE_LOCAL Local<Function> Fiber::starting_cb;
+ISOLATE_LOCAL Local<Context> Fiber::starting_context;
+ISOLATE_LOCAL uint64_t Fiber::pool_idle_time = 30000;
+ISOLATE_LOCAL bool did_init = false;
+#ifdef CORO_PTHREAD
+static Isolate* did_init_isolate = NULL;
+#endif
 
 #if !NODE_VERSION_AT_LEAST(0,10,0)
 extern "C"
@@ -914,6 +1914,16 @@ extern "C"
 void init(Local<Object> target) {
 	Isolate* isolate = Isolate::GetCurrent();
 	Local<Context> context = isolate->GetCurrentContext();
+#ifdef CORO_PTHREAD
+	// There's only one runtime in the process, see ISOLATE_LOCAL
+	if (did_init_isolate && did_init_isolate != isolate) {
+		Local<Object> err = Local<Object>::Cast(Exception::Error(uni::NewLatin1String(isolate, "Fibers built with CORO_PTHREAD can only be used from one thread")));
+		err->Set(context, uni::NewLatin1Symbol(isolate, "code"), uni::NewLatin1String(isolate, "ERR_FIBER_WORKER")).FromJust();
+		uni::ThrowException(isolate, err);
+		return;
+	}
+	did_init_isolate = isolate;
+#endif
 	if (did_init || !target->Get(context, uni::NewLatin1Symbol(isolate, "Fiber")).ToLocalChecked()->IsUndefined()) {
 		// Oh god. Node will call init() twice even though the library was loaded only once. See Node
 		// issue #2621 (no fix).
@@ -924,7 +1934,17 @@ void init(Local<Object> target) {
 	Coroutine::init(isolate);
 	Fiber::Init(target);
 	// Default stack size of either 512k or 1M. Perhaps make this configurable by the run time?
-	Coroutine::set_stack_size(128 * 1024);
+	bool stack_size_ok = Coroutine::set_stack_size(128 * 1024);
+	assert(stack_size_ok);
+	(void)stack_size_ok;
 }
 
+#if NODE_VERSION_AT_LEAST(10, 5, 0)
+// Each worker thread loads the module again for its own isolate. A context aware module with the
+// well known initializer symbol is the only kind node will initialize more than once.
+NODE_MODULE_INIT() {
+	init(exports);
+}
+#else
 NODE_MODULE(fibers, init)
+#endif
@@ -91,6 +91,8 @@ coro_init (void)
 
 #if __GCC_HAVE_DWARF2_CFI_ASM && __amd64
   asm (".cfi_undefined rip");
+#elif __GCC_HAVE_DWARF2_CFI_ASM && __aarch64__
+  asm (".cfi_undefined x30");
 #endif
 
   func ((void *)arg);
@@ -123,6 +125,16 @@ trampoline (int sig)
 
   asm (
        "\t.text\n"
+       #if __arm__
+       "\t.syntax unified\n"
+       "\t.arm\n"
+       "\t.align 2\n"
+       #elif __aarch64__
+       "\t.align 2\n"
+       #endif
+       #if __ELF__ && (__arm__ || __aarch64__)
+       "\t.type coro_transfer, %function\n"
+       #endif
        #if _WIN32 || __CYGWIN__ || __APPLE__
        "\t.globl _coro_transfer\n"
        "_coro_transfer:\n"
@@ -187,15 +199,24 @@ trampoline (int sig)
            "\tmovaps 144(%rsp), %xmm15\n"
            "\taddq $168, %rsp\n"
          #else
-           #define NUM_SAVED 6
+           /* the SysV ABI makes the MXCSR and x87 control words callee-saved, too. we keep them in
+              one extra qword at the bottom of the frame: mxcsr at 0(%rsp), fpu cw at 4(%rsp). */
+           #define NUM_SAVED 7
+           #define CORO_SAVE_FPU_CW 1
            "\tpushq %rbp\n"
            "\tpushq %rbx\n"
            "\tpushq %r12\n"
            "\tpushq %r13\n"
            "\tpushq %r14\n"
            "\tpushq %r15\n"
+           "\tsubq $8, %rsp\n"
+           "\tstmxcsr (%rsp)\n"
+           "\tfnstcw 4(%rsp)\n"
            "\tmovq %rsp, (%rdi)\n"
            "\tmovq (%rsi), %rsp\n"
+           "\tldmxcsr (%rsp)\n"
+           "\tfldcw 4(%rsp)\n"
+           "\taddq $8, %rsp\n"
            "\tpopq %r15\n"
            "\tpopq %r14\n"
            "\tpopq %r13\n"
@@ -234,6 +255,74 @@ trampoline (int sig)
          "\tpopl %ecx\n"
          "\tjmpl *%ecx\n"
 
+       #elif __aarch64__
+
+         /* AAPCS64: x19-x29, lr, the low halves of v8-v15 and fpcr survive a call. the frame is
+            x19-x28, d8-d15, fpcr, padding, x29 and lr, so sp stays 16 byte aligned. */
+         #define NUM_SAVED 22
+         #define CORO_RETURN_SLOT 21
+         "\tsub sp, sp, #8 * 22\n"
+         "\tstp x19, x20, [sp, #16 * 0]\n"
+         "\tstp x21, x22, [sp, #16 * 1]\n"
+         "\tstp x23, x24, [sp, #16 * 2]\n"
+         "\tstp x25, x26, [sp, #16 * 3]\n"
+         "\tstp x27, x28, [sp, #16 * 4]\n"
+         "\tstp d8, d9, [sp, #16 * 5]\n"
+         "\tstp d10, d11, [sp, #16 * 6]\n"
+         "\tstp d12, d13, [sp, #16 * 7]\n"
+         "\tstp d14, d15, [sp, #16 * 8]\n"
+         "\tmrs x2, fpcr\n"
+         "\tstr x2, [sp, #16 * 9]\n"
+         "\tstp x29, x30, [sp, #16 * 10]\n"
+         "\tmov x2, sp\n"
+         "\tstr x2, [x0]\n"
+         "\tldr x2, [x1]\n"
+         "\tmov sp, x2\n"
+         "\tldp x19, x20, [sp, #16 * 0]\n"
+         "\tldp x21, x22, [sp, #16 * 1]\n"
+         "\tldp x23, x24, [sp, #16 * 2]\n"
+         "\tldp x25, x26, [sp, #16 * 3]\n"
+         "\tldp x27, x28, [sp, #16 * 4]\n"
+         "\tldp d8, d9, [sp, #16 * 5]\n"
+         "\tldp d10, d11, [sp, #16 * 6]\n"
+         "\tldp d12, d13, [sp, #16 * 7]\n"
+         "\tldp d14, d15, [sp, #16 * 8]\n"
+         "\tldr x2, [sp, #16 * 9]\n"
+         "\tmsr fpcr, x2\n"
+         "\tldp x29, x30, [sp, #16 * 10]\n"
+         "\tadd sp, sp, #8 * 22\n"
+         "\tret\n"
+
+       #elif __arm__
+
+         /* AAPCS: r4-r11, lr and, with a VFP unit, d8-d15 and fpscr survive a call. lr ends up in
+            the same slot either way; r3 is scratch and only pads the frame to 8 bytes. */
+         #define CORO_RETURN_SLOT 9
+         #if __ARM_FP
+           #define NUM_SAVED 26
+           "\tvpush {d8-d15}\n"
+           "\tpush {r4-r11, lr}\n"
+           "\tvmrs r2, fpscr\n"
+           "\tpush {r2}\n"
+         #else
+           #define NUM_SAVED 10
+           "\tpush {r3-r11, lr}\n"
+         #endif
+         "\tstr sp, [r0]\n"
+         "\tldr sp, [r1]\n"
+         #if __ARM_FP
+           "\tpop {r2}\n"
+           "\tvmsr fpscr, r2\n"
+           "\tpop {r4-r11, lr}\n"
+           "\tvpop {d8-d15}\n"
+         #else
+           "\tpop {r3-r11, lr}\n"
+         #endif
+         "\tbx lr\n"
+         #if __thumb__
+           "\t.thumb\n"
+         #endif
+
        #else
          #error unsupported architecture
        #endif
@@ -363,8 +452,10 @@ coro_create (coro_context *ctx, coro_func coro, void *arg, void *sptr, size_t ss
 # elif CORO_ASM
 
   ctx->sp = (void **)(ssize + (char *)sptr);
+  #if __i386 || __amd64
   *--ctx->sp = (void *)abort; /* needed for alignment only */
   *--ctx->sp = (void *)coro_init;
+  #endif
 
   #if CORO_WIN_TIB
   *--ctx->sp = 0;                    /* ExceptionList */
@@ -375,6 +466,32 @@ coro_create (coro_context *ctx, coro_func coro, void *arg, void *sptr, size_t ss
   ctx->sp -= NUM_SAVED;
   memset (ctx->sp, 0, sizeof (*ctx->sp) * NUM_SAVED);
 
+  #ifdef CORO_RETURN_SLOT
+  /* arm returns through the saved lr instead of popping a return address */
+  ctx->sp[CORO_RETURN_SLOT] = (void *)coro_init;
+  #endif
+
+  #if __aarch64__
+  {
+    unsigned long fpcr;
+    asm ("mrs %0, fpcr" : "=r" (fpcr));
+    ctx->sp[18] = (void *)fpcr;
+  }
+  #elif __arm__ && __ARM_FP
+  {
+    unsigned long fpscr;
+    asm ("vmrs %0, fpscr" : "=r" (fpscr));
+    ctx->sp[0] = (void *)fpscr;
+  }
+  #endif
+
+  #if CORO_SAVE_FPU_CW
+  /* new coroutines inherit the creator's floating point environment, all-zero would unmask every
+     floating point exception */
+  asm ("stmxcsr %0" : "=m" (*(unsigned int *)ctx->sp));
+  asm ("fnstcw %0" : "=m" (*((unsigned short *)ctx->sp + 2)));
+  #endif
+
 # elif CORO_UCONTEXT
 
   getcontext (&(ctx->uc));
@@ -602,7 +719,7 @@ coro_destroy (coro_context *ctx)
 # undef CORO_GUARDPAGES
 #endif
 
-#if !__i386 && !__x86_64 && !__powerpc && !__m68k && !__alpha && !__mips && !__sparc64
+#if !__i386 && !__x86_64 && !__powerpc && !__m68k && !__alpha && !__mips && !__sparc64 && !__arm__ && !__aarch64__
 # undef CORO_GUARDPAGES
 #endif
 
@@ -140,8 +140,8 @@ extern "C" {
  * -DCORO_ASM
  *
  *    Hand coded assembly, known to work only on a few architectures/ABI:
- *    GCC + x86/IA32 and amd64/x86_64 + GNU/Linux and a few BSDs. Fastest choice,
- *    if it works.
+ *    GCC + x86/IA32, amd64/x86_64, ARMv6+ (AAPCS) and aarch64 (AAPCS64) +
+ *    GNU/Linux and a few BSDs. Fastest choice, if it works.
  *
  * -DCORO_PTHREAD
  *
@@ -303,7 +303,7 @@ void coro_stack_free (struct coro_stack *stack);
 #  define CORO_ASM 1
 # elif defined WINDOWS || defined _WIN32
 #  define CORO_LOSER 1 /* you don't win with windoze */
-# elif __linux && (__i386 || (__x86_64 && !__ILP32))
+# elif __linux && (__i386 || (__x86_64 && !__ILP32) || __arm__ || (__aarch64__ && !__ILP32__))
 #  define CORO_ASM 1
 # elif __APPLE__ && (__i386 || (__x86_64 && !__ILP32))
 #  define CORO_ASM 1
@@ -377,7 +377,11 @@ struct coro_context
   void **sp; /* must be at offset 0 */
 };
 
+#if __i386
 void __attribute__ ((__noinline__, __regparm__(2)))
+#else
+void __attribute__ ((__noinline__))
+#endif
 coro_transfer (coro_context *prev, coro_context *next);
 
 # define coro_destroy(ctx) (void *)(ctx)
@@ -0,0 +1,46 @@
+var Fiber = require('fibers');
+var inspector = require('inspector');
+
+// Count the nodes named `name` in a heap snapshot, and find the biggest one
+function nodes(snapshot, name) {
+	var fields = snapshot.snapshot.meta.node_fields;
+	var nameField = fields.indexOf('name');
+	var sizeField = fields.indexOf('self_size');
+	var nameIndex = snapshot.strings.indexOf(name);
+	var found = { count: 0, size: 0 };
+	for (var ii = 0; ii < snapshot.nodes.length; ii += fields.length) {
+		if (snapshot.nodes[ii + nameField] === nameIndex) {
+			++found.count;
+			found.size = Math.max(found.size, snapshot.nodes[ii + sizeField]);
+		}
+	}
+	return found;
+}
+
+var started = [];
+for (var ii = 0; ii < 3; ++ii) {
+	var fiber = Fiber(function() {
+		Fiber.yield();
+	});
+	fiber.run();
+	started.push(fiber);
+}
+var notStarted = Fiber(function() {});
+
+var session = new inspector.Session;
+var chunks = [];
+session.connect();
+session.on('HeapProfiler.addHeapSnapshotChunk', function(message) {
+	chunks.push(message.params.chunk);
+});
+session.post('HeapProfiler.takeHeapSnapshot', null, function(err) {
+	session.disconnect();
+	var snapshot = JSON.parse(chunks.join(''));
+	var startedNodes = nodes(snapshot, 'Fiber (started)');
+	var notStartedNodes = nodes(snapshot, 'Fiber (not started)');
+	for (var ii = 0; ii < started.length; ++ii) {
+		started[ii].run();
+	}
+	!err && startedNodes.count === 3 && startedNodes.size >= Fiber.defaultStackSize &&
+		notStartedNodes.count === 1 && console.log('pass');
+});
@@ -0,0 +1,48 @@
+var Fiber = require('fibers');
+var vm = require('vm');
+require('v8').setFlagsFromString('--expose-gc');
+var gc = vm.runInNewContext('gc');
+
+function live() {
+	return Fiber.stats()[Fiber.statsFields.indexOf('fibersLive')];
+}
+
+// A fiber runs in the context it was created in
+var sandbox = vm.createContext({ Fiber: Fiber, where: 'sandbox' });
+var fromSandbox = vm.runInContext('Fiber(function() { return where; })', sandbox);
+var context = fromSandbox.run() === 'sandbox';
+
+// A fiber holds its function and global object, but nothing global holds the fiber, so one which
+// hasn't started yet is collected even when its function points back at it
+function unstarted() {
+	var fiber = Fiber(function() {
+		return fiber;
+	});
+}
+
+// A started one is unwound, as long as it's not holding on to itself from its own stack
+var unwound = 0;
+function started() {
+	Fiber(function() {
+		try {
+			Fiber.yield();
+		} finally {
+			++unwound;
+		}
+	}).run();
+}
+
+function abandon() {
+	for (var ii = 0; ii < 10; ++ii) {
+		unstarted();
+		started();
+	}
+}
+var before = live();
+abandon();
+var created = live() === before + 20;
+gc();
+var collected = live() === before + 10;
+setImmediate(function() {
+	context && created && collected && unwound === 10 && console.log('pass');
+});
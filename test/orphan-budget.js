@@ -0,0 +1,49 @@
+var Fiber = require('fibers');
+require('v8').setFlagsFromString('--expose-gc');
+var gc = require('vm').runInNewContext('gc');
+
+function pending() {
+	return Fiber.stats()[Fiber.statsFields.indexOf('orphansPending')];
+}
+
+// Abandon `count` suspended fibers which each take a while to unwind
+var unwound = 0;
+function abandon(count) {
+	for (var ii = 0; ii < count; ++ii) {
+		Fiber(function() {
+			try {
+				Fiber.yield();
+			} finally {
+				var until = process.hrtime();
+				until = until[0] * 1e9 + until[1] + 2e5;
+				for (var now = 0; now < until;) {
+					now = process.hrtime();
+					now = now[0] * 1e9 + now[1];
+				}
+				++unwound;
+			}
+		}).run();
+	}
+}
+
+// Nothing runs from inside the collector, and with a 1ms budget 50 of these take several turns
+Fiber.orphanBudget = 1;
+abandon(50);
+gc();
+var queued = unwound === 0 && pending() === 50 && Fiber.orphanBudget === 1;
+var turns = 0;
+(function turn() {
+	++turns;
+	if (unwound < 50) {
+		return setImmediate(turn);
+	}
+	var budgeted = turns > 2 && pending() === 0;
+
+	// Without a budget the whole backlog goes at once
+	Fiber.orphanBudget = 0;
+	abandon(50);
+	gc();
+	setImmediate(function() {
+		queued && budgeted && unwound === 100 && pending() === 0 && console.log('pass');
+	});
+})();
@@ -0,0 +1,39 @@
+var Fiber = require('fibers');
+
+function pooled() {
+	return Fiber.stats()[Fiber.statsFields.indexOf('poolSize')];
+}
+
+function burst(count) {
+	var fibers = [];
+	for (var ii = 0; ii < count; ++ii) {
+		var fiber = Fiber(function() {
+			Fiber.yield();
+		});
+		fiber.run();
+		fibers.push(fiber);
+	}
+	for (var ii = 0; ii < fibers.length; ++ii) {
+		fibers[ii].run();
+	}
+}
+
+Fiber.poolSize = 5;
+Fiber.poolMaxSize = 50;
+Fiber.poolIdleTime = 20;
+
+// The pool grows with demand, but no further than poolMaxSize
+burst(30);
+var grown = pooled() === 30;
+burst(80);
+var capped = pooled() === 50;
+
+// Once things are quiet it shrinks back to poolSize
+var tries = 0;
+(function check() {
+	if (pooled() === 5) {
+		grown && capped && console.log('pass');
+	} else if (++tries < 100) {
+		setTimeout(check, 20);
+	}
+})();
@@ -0,0 +1,38 @@
+var Fiber = require('fibers');
+
+function stat(name) {
+	return Fiber.stats()[Fiber.statsFields.indexOf(name)];
+}
+
+// Prewarmed fibers come out of the pool without creating anything new
+Fiber.poolSize = 10;
+var added = Fiber.prewarm(20);
+var created = stat('coroutinesCreated');
+var fibers = [];
+for (var ii = 0; ii < 10; ++ii) {
+	var fiber = Fiber(function() {
+		Fiber.yield();
+	});
+	fiber.run();
+	fibers.push(fiber);
+}
+var prewarmed = added === 10 && stat('coroutinesCreated') === created && stat('poolHits') === 10;
+for (var ii = 0; ii < fibers.length; ++ii) {
+	fibers[ii].run();
+}
+
+// The reserve is filled by a helper thread, so wait for it to catch up
+if (process.platform === 'win32') {
+	prewarmed && console.log('pass');
+} else {
+	var inUse = Fiber.stackInUse;
+	Fiber.stackReserve = 4;
+	var tries = 0;
+	(function check() {
+		if (Fiber.stackInUse >= inUse + 4 * Fiber.defaultStackSize) {
+			prewarmed && Fiber.stackReserve === 4 && console.log('pass');
+		} else if (++tries < 100) {
+			setTimeout(check, 10);
+		}
+	})();
+}
@@ -0,0 +1,47 @@
+var Fiber = require('fibers');
+
+// Leave room for exactly four fibers, with nothing held back in the pool
+Fiber.poolSize = 0;
+Fiber.poolMaxSize = 0;
+Fiber.stackBudget = Fiber.stackInUse + 4 * Fiber.defaultStackSize;
+var fibers = [];
+for (var ii = 0; ii < 4; ++ii) {
+	var fiber = Fiber(function() {
+		Fiber.yield();
+	});
+	fiber.run();
+	fibers.push(fiber);
+}
+
+// A fifth fails fast
+var code;
+try {
+	Fiber(function() {}).run();
+} catch (err) {
+	code = err.code;
+}
+
+// Unless it's allowed to wait in line, in which case it starts in order once there's room
+Fiber.stackBudgetQueue = true;
+var order = [];
+var queued = [1, 2, 3].map(function(value) {
+	var fiber = Fiber(function() {
+		order.push(value);
+	});
+	return { result: fiber.run(), started: fiber.started };
+});
+var waited = order.length === 0 && queued.every(function(run) {
+	return run.result === undefined && run.started === false;
+});
+fibers[0].run();
+var tries = 0;
+(function check() {
+	if (order.length === 3) {
+		for (var ii = 1; ii < fibers.length; ++ii) {
+			fibers[ii].run();
+		}
+		code === 'ERR_FIBER_STACK_BUDGET' && waited && order.join() === '1,2,3' && console.log('pass');
+	} else if (++tries < 100) {
+		setTimeout(check, 10);
+	}
+})();
@@ -0,0 +1,21 @@
+var Fiber = require('fibers');
+function depth() {
+	var n = 0;
+	function foo() {
+		++n;
+		foo();
+	}
+	try {
+		foo();
+	} catch (err) {
+		return err.name === 'RangeError' ? n : 0;
+	}
+}
+var small = Fiber(depth, { stackSize: 64 * 1024 }).run();
+var large = new Fiber(depth, { stackSize: 4 * 1024 * 1024 }).run();
+var normal = Fiber(depth).run();
+try {
+	Fiber.defaultStackSize = 64 * 1024;
+} catch (err) {
+	small && small < normal && normal <= large && console.log('pass');
+}
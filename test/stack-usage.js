@@ -0,0 +1,32 @@
+var Fiber = require('fibers');
+
+function recurse(depth) {
+	var frame = [ depth, depth, depth, depth ];
+	return depth ? recurse(depth - 1) + frame.length : 0;
+}
+
+function sum(histogram) {
+	return histogram.reduce(function(total, count) {
+		return total + count;
+	}, 0);
+}
+
+// Nothing is measured until tracking is turned on
+var untracked = Fiber(function() {});
+untracked.run();
+var off = untracked.stackUsage === undefined && sum(Fiber.stackUsageHistogram()) === 0;
+
+Fiber.stackUsageTracking = true;
+var deep = Fiber(function() {
+	recurse(2000);
+	Fiber.yield(Fiber.current.stackUsage);
+});
+var running = deep.run();
+deep.run();
+var shallow = Fiber(function() {});
+shallow.run();
+
+// The peak sticks around once a fiber finishes, and each finished fiber lands in one bucket
+var histogram = Fiber.stackUsageHistogram();
+off && running > 0 && deep.stackUsage >= running && shallow.stackUsage < deep.stackUsage &&
+	sum(histogram) === 2 && histogram.lastIndexOf(1) > histogram.indexOf(1) && console.log('pass');
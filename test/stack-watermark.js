@@ -0,0 +1,30 @@
+var Fiber = require('fibers');
+
+function recurse(depth) {
+	var frame = [ depth, depth, depth, depth ];
+	return depth ? recurse(depth - 1) + frame.length : 0;
+}
+
+// Windows doesn't give the unused part of a stack back
+if (process.platform === 'win32') {
+	console.log('pass');
+} else {
+	Fiber.stackWatermark = 16 * 1024;
+	var fibers = [];
+	for (var ii = 0; ii < 32; ++ii) {
+		var fiber = Fiber(function() {
+			recurse(4000);
+			Fiber.yield();
+		});
+		fiber.run();
+		fibers.push(fiber);
+	}
+	var before = Fiber.stackResident;
+
+	// All 32 go back in the pool, and all but the most recent few get trimmed to the watermark
+	for (var ii = 0; ii < fibers.length; ++ii) {
+		fibers[ii].run();
+	}
+	var after = Fiber.stackResident;
+	after < before / 2 && console.log('pass');
+}
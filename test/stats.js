@@ -0,0 +1,19 @@
+var Fiber = require('fibers');
+
+function index(name) {
+	return Fiber.statsFields.indexOf(name);
+}
+
+// The same array comes back each time, refreshed in place
+var stats = Fiber.stats();
+var switches = stats[index('switches')];
+var started = stats[index('fibersStarted')];
+var fiber = Fiber(function() {
+	Fiber.yield();
+});
+fiber.run();
+var same = Fiber.stats() === stats && stats.length === Fiber.statsFields.length;
+var yielding = stats[index('fibersYielding')] === 1 && stats[index('fibersStarted')] === started + 1;
+fiber.run();
+same && yielding && Fiber.stats() === stats && stats[index('switches')] === switches + 4 &&
+	stats[index('fibersYielding')] === 0 && console.log('pass');
@@ -0,0 +1,30 @@
+var Fiber = require('fibers');
+
+function run(count) {
+	for (var ii = 0; ii < count; ++ii) {
+		var fiber = Fiber(function() {
+			Fiber.yield();
+		});
+		fiber.run();
+		fiber.run();
+	}
+}
+
+// Nothing is timed until switchTiming is on
+run(10);
+Fiber.switchTiming = true;
+var empty = Fiber.switchLatency().count === 0;
+
+// Each fiber switches in and out twice
+run(100);
+var latency = Fiber.switchLatency();
+var ordered = latency.min > 0 && latency.min <= latency.p50 && latency.p50 <= latency.p90 &&
+	latency.p90 <= latency.p99 && latency.p99 <= latency.p999 && latency.p999 <= latency.max * 1.05 &&
+	latency.mean >= latency.min && latency.mean <= latency.max;
+
+// Turning it back on starts over
+Fiber.switchTiming = false;
+run(10);
+var kept = Fiber.switchLatency().count === 400;
+Fiber.switchTiming = true;
+empty && latency.count === 400 && ordered && kept && Fiber.switchLatency().count === 0 && console.log('pass');
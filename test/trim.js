@@ -0,0 +1,29 @@
+var Fiber = require('fibers');
+require('v8').setFlagsFromString('--expose-gc');
+var gc = require('vm').runInNewContext('gc');
+
+function pooled() {
+	return Fiber.stats()[Fiber.statsFields.indexOf('poolSize')];
+}
+
+// Abandon some suspended fibers, and leave a few finished ones in the pool
+var unwound = 0;
+for (var ii = 0; ii < 20; ++ii) {
+	Fiber(function() {
+		try {
+			Fiber.yield();
+		} finally {
+			++unwound;
+		}
+	}).run();
+}
+for (var ii = 0; ii < 10; ++ii) {
+	Fiber(function() {}).run();
+}
+gc();
+
+// trim() unwinds the abandoned fibers right away instead of waiting for the event loop, then
+// empties the pool
+var before = pooled();
+var released = Fiber.trim();
+unwound === 20 && before > 0 && released >= before && pooled() === 0 && console.log('pass');
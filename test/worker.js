@@ -0,0 +1,73 @@
+var workers;
+try {
+	workers = require('worker_threads');
+} catch (err) {}
+var Fiber;
+try {
+	Fiber = require('fibers');
+} catch (err) {
+	// Builds with a thread per fiber only work from the first thread which loads them
+	if (err.code !== 'ERR_FIBER_WORKER') {
+		throw err;
+	}
+}
+
+function recurse(depth) {
+	return depth ? recurse(depth - 1) + 1 : 0;
+}
+
+if (!workers) {
+	if (/^v10\./.test(process.version) && process.execArgv.indexOf('--experimental-worker') === -1) {
+		// Workers are behind a flag in node v10
+		require('child_process').spawn(process.execPath, ['--experimental-worker', '--no-warnings', __filename], { stdio: 'inherit' });
+	} else {
+		console.log('pass');
+	}
+} else if (workers.isMainThread) {
+	// The stack reserve is shared by the whole process, the worker still gets its own default size
+	Fiber.stackReserve = 2;
+	var result;
+	var worker = new workers.Worker(__filename);
+	worker.on('message', function(message) {
+		result = message;
+	});
+	worker.on('exit', function(code) {
+		if (code === 0 && result && (result.unsupported ||
+			result.defaultStackSize === Fiber.defaultStackSize && result.depth === 3000 && result.sum === 4950)) {
+			console.log('pass');
+		}
+	});
+} else if (!Fiber) {
+	workers.parentPort.postMessage({ unsupported: true });
+} else {
+	var sum = 0;
+	var fibers = [];
+	for (var ii = 0; ii < 100; ++ii) {
+		var fiber = Fiber(function(value) {
+			sum += value;
+			// Left suspended, to be unwound when the worker exits
+			Fiber.yield();
+		});
+		fiber.run(ii);
+		fibers.push(fiber);
+	}
+	// These are unwound too, and what they throw is dropped
+	[ 'primitive', new Error('thrown while unwinding') ].forEach(function(thrown) {
+		var fiber = Fiber(function() {
+			try {
+				Fiber.yield();
+			} finally {
+				throw thrown;
+			}
+		});
+		fiber.run();
+		fibers.push(fiber);
+	});
+	workers.parentPort.postMessage({
+		defaultStackSize: Fiber.defaultStackSize,
+		depth: Fiber(function() {
+			return recurse(3000);
+		}).run(),
+		sum: sum,
+	});
+}
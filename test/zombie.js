@@ -0,0 +1,37 @@
+var Fiber = require('fibers');
+require('v8').setFlagsFromString('--expose-gc');
+var gc = require('vm').runInNewContext('gc');
+
+var caught = [];
+function unwindable() {
+	return Fiber(function() {
+		try {
+			Fiber.yield();
+		} catch (err) {
+			caught.push(err);
+			throw err;
+		}
+	});
+}
+
+// reset() unwinds a fiber by throwing into it, and it's the same exception every time
+var fibers = [];
+for (var ii = 0; ii < 2; ++ii) {
+	fibers.push(unwindable());
+	fibers[ii].run();
+}
+var results = fibers.map(function(fiber) {
+	return fiber.reset();
+});
+
+// Fibers abandoned while suspended get the same one as well
+function abandon() {
+	unwindable().run();
+}
+abandon();
+gc();
+setImmediate(function() {
+	caught.length === 3 && caught[0] === caught[1] && caught[1] === caught[2] &&
+		caught[0] instanceof Error && results[0] === undefined && results[1] === undefined &&
+		console.log('pass');
+});